@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef WIN32
+    #include <malloc.h>
+#endif
+
+// Allocator for std::vector whose storage starts on an Alignment byte boundary
+// Used for tables that are scanned with SIMD loads, where rows should not
+// straddle cache lines because of where the allocator happened to put them
+template <class T, size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+
+    typedef T value_type;
+
+    template <class U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T * allocate(size_t n)
+    {
+        if (n == 0) { return nullptr; }
+        void * p = nullptr;
+
+        #ifdef WIN32
+            p = _aligned_malloc(n * sizeof(T), Alignment);
+        #else
+            if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) { p = nullptr; }
+        #endif
+
+        if (!p) { throw std::bad_alloc(); }
+        return (T *)p;
+    }
+
+    void deallocate(T * p, size_t)
+    {
+        #ifdef WIN32
+            _aligned_free(p);
+        #else
+            free(p);
+        #endif
+    }
+
+    template <class U> bool operator == (const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <class U> bool operator != (const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <class T, size_t Alignment = 64>
+using AlignedVector = std::vector<T, AlignedAllocator<T, Alignment>>;
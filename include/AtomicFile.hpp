@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+// Files that are replaced whole, so a reader only ever finds the old contents
+// or the new ones. The bytes are written to <file>.tmp, which is then renamed
+// over the file in a single step. The old file is never removed first, as
+// that would leave a moment with no file at all for a process that is
+// stopped then to come back to. Files that many processes create at once are
+// built whole under a name of their own, and moved into place only if no other
+// process got there first
+namespace AtomicFile
+{
+    inline std::string TempName(const std::string & filename)
+    {
+        return filename + ".tmp";
+    }
+
+    // renames from to to, replacing any file already there in one step
+    inline bool Replace(const std::string & from, const std::string & to)
+    {
+        #ifdef _WIN32
+            return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+        #else
+            return std::rename(from.c_str(), to.c_str()) == 0;
+        #endif
+    }
+
+    // a temporary name that no other process uses
+    inline std::string ProcessTempName(const std::string & filename)
+    {
+        #ifdef _WIN32
+            return TempName(filename) + std::to_string((unsigned long)GetCurrentProcessId());
+        #else
+            return TempName(filename) + std::to_string((long)getpid());
+        #endif
+    }
+
+    inline bool Exists(const std::string & filename)
+    {
+        return std::ifstream(filename).good();
+    }
+
+    // renames from to to unless a file is already there, which is left alone
+    inline bool Publish(const std::string & from, const std::string & to)
+    {
+        #ifdef _WIN32
+            return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_WRITE_THROUGH) != 0;
+        #else
+            bool published = link(from.c_str(), to.c_str()) == 0;
+            std::remove(from.c_str());
+            return published;
+        #endif
+    }
+
+    // writes size bytes through the temporary file, what names the file in errors
+    inline bool Write(const std::string & filename, const char * data, size_t size, const std::string & what)
+    {
+        std::string tempFilename = TempName(filename);
+        {
+            std::ofstream fout(tempFilename, std::ios::binary);
+            fout.write(data, size);
+            fout.close();
+            if (fout.fail())
+            {
+                std::cerr << "Could not write " << what << ": " << tempFilename << "\n";
+                return false;
+            }
+        }
+
+        if (!Replace(tempFilename, filename))
+        {
+            std::cerr << "Could not replace " << what << ": " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // creates filename holding size bytes if it does not exist yet, so the
+    // file is either missing or complete. returns false when it already
+    // existed, or some other process created it first
+    inline bool Create(const std::string & filename, const char * data, size_t size, const std::string & what)
+    {
+        std::string tempFilename = ProcessTempName(filename);
+        {
+            std::ofstream fout(tempFilename, std::ios::binary);
+            fout.write(data, size);
+            fout.close();
+            if (fout.fail())
+            {
+                std::cerr << "Could not write " << what << ": " << tempFilename << "\n";
+                std::remove(tempFilename.c_str());
+                return false;
+            }
+        }
+
+        if (Publish(tempFilename, filename)) { return true; }
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+
+    // cuts a file back to its first size bytes in place, for carrying on a file
+    // that a resumed run wrote part of. nothing before size is read or
+    // rewritten, so the kept bytes survive a crash at any point. a file
+    // shorter than size fails, as the run it continues could not be exact
+    inline bool TruncateTo(const std::string & filename, uint64_t size, const std::string & what)
+    {
+        uint64_t fileSize = 0;
+        bool good = false;
+
+        #ifdef _WIN32
+            HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file != INVALID_HANDLE_VALUE)
+            {
+                LARGE_INTEGER current, offset;
+                offset.QuadPart = (LONGLONG)size;
+                if (GetFileSizeEx(file, &current)) { fileSize = (uint64_t)current.QuadPart; }
+                good = fileSize >= size && SetFilePointerEx(file, offset, NULL, FILE_BEGIN) && SetEndOfFile(file);
+                CloseHandle(file);
+            }
+        #else
+            struct stat st;
+            if (stat(filename.c_str(), &st) == 0)
+            {
+                fileSize = (uint64_t)st.st_size;
+                good = fileSize >= size && truncate(filename.c_str(), (off_t)size) == 0;
+            }
+        #endif
+
+        if (!good)
+        {
+            std::cerr << "Could not continue " << what << " at byte " << size << ", it has " << fileSize << ": " << filename << "\n";
+        }
+        return good;
+    }
+}
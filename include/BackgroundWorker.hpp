@@ -0,0 +1,84 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+// A single thread that runs jobs one at a time in the order they were submitted
+// Used to move slow file output off the simulation thread: the caller takes a
+// snapshot of whatever it wants written and hands the writing over as a job
+// The thread is only started on the first submit, and is joined on destruction
+// after every job that was already submitted has finished
+class BackgroundWorker
+{
+    std::thread                         m_thread;
+    std::mutex                          m_mutex;
+    std::condition_variable             m_jobCondition;
+    std::condition_variable             m_idleCondition;
+    std::deque<std::function<void()>>   m_jobs;
+    size_t                              m_pending = 0;  // jobs queued or running
+    bool                                m_stop = false;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_jobCondition.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty()) { return; }
+
+            auto job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+
+            lock.unlock();
+            job();
+            lock.lock();
+
+            if (--m_pending == 0) { m_idleCondition.notify_all(); }
+        }
+    }
+
+public:
+
+    BackgroundWorker() {}
+
+    ~BackgroundWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_jobCondition.notify_all();
+        if (m_thread.joinable()) { m_thread.join(); }
+    }
+
+    BackgroundWorker(const BackgroundWorker &) = delete;
+    BackgroundWorker & operator = (const BackgroundWorker &) = delete;
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_thread.joinable()) { m_thread = std::thread(&BackgroundWorker::run, this); }
+            m_jobs.push_back(std::move(job));
+            m_pending++;
+        }
+        m_jobCondition.notify_one();
+    }
+
+    // number of jobs that are queued or still running
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending;
+    }
+
+    // blocks until every submitted job has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idleCondition.wait(lock, [&] { return m_pending == 0; });
+    }
+};
@@ -8,4 +8,5 @@
 #include "Simulator.hpp"
 #include "Components.hpp"
 #include "GUI.hpp"
-#include "Timer.hpp"
\ No newline at end of file
+#include "Timer.hpp"
+#include "ThreadPool.hpp"
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <bitset>
 #include <array>
 #include <memory>
+#include <string>
 
 #include "Vec2.hpp"
 
@@ -47,12 +48,24 @@ public:
 class GridSensor;
 class PuckSensor;
 class ObstacleSensor;
+class RangeSensor;
+class FieldSensor;
+class SensorLayout;
 class CSensorArray
 {
 public:
     std::vector<std::shared_ptr<GridSensor>>     gridSensors;
     std::vector<std::shared_ptr<PuckSensor>>     puckSensors;
     std::vector<std::shared_ptr<ObstacleSensor>> obstacleSensors;
+    std::vector<std::shared_ptr<RangeSensor>>    rangeSensors;
+    std::vector<std::shared_ptr<FieldSensor>>    fieldSensors;
+
+    // observation vector built from the sensors above, see SensorTools
+    std::shared_ptr<SensorLayout>   layout;
+    std::vector<size_t>             featureIndex;       // observation slot of each sensor value
+    std::vector<double>             observation;
+    size_t                          observationStep = (size_t)-1;
+
     CSensorArray() {}
 };
 
@@ -98,6 +111,18 @@ public:
         : r((uint8_t)rr), g((uint8_t)gg), b((uint8_t)bb), a((uint8_t)aa) {}
 };
 
+// Leaves a trail in one of the world's dynamic fields, such as a pheromone
+// the world adds amount per unit of time to the cell under the entity every step
+class CFieldDeposit
+{
+public:
+    std::string field;
+    double amount = 0;
+    CFieldDeposit() {}
+    CFieldDeposit(const std::string & f, double a)
+        : field(f), amount(a) {}
+};
+
 class EntityController;
 class CController
 {
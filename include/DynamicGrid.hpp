@@ -0,0 +1,188 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+#include "Vec2.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define CWAGGLE_DYNAMIC_GRID_SSE
+#endif
+
+// A field that changes over time, such as a pheromone trail
+// Robots deposit into cells, and every update the field diffuses a fraction
+// of each cell into its four neighbours and evaporates a fraction of it
+// The stencil runs over rows with SSE and can be split across a thread pool
+class DynamicGrid
+{
+    struct Deposit
+    {
+        size_t index;
+        float  amount;
+
+        bool operator < (const Deposit & rhs) const
+        {
+            return index < rhs.index || (index == rhs.index && amount < rhs.amount);
+        }
+    };
+
+    size_t m_width = 0;
+    size_t m_height = 0;
+    float  m_diffusion = 0;     // fraction of a cell spread to its neighbours per update
+    float  m_evaporation = 0;   // fraction of a cell lost per update
+    size_t m_updateSkip = 1;    // the stencil runs once every this many ticks
+
+    std::vector<float> m_values;
+    std::vector<float> m_next;
+
+    std::vector<Deposit>        m_deposits;     // deposits waiting for the next tick
+    std::mutex                  m_depositMutex;
+    std::shared_ptr<ThreadPool> m_pool;
+
+    // diffusion + evaporation for rows [y0, y1) from m_values into m_next
+    // cells on the border reflect back into themselves, so diffusion alone conserves the total
+    void stencilRows(size_t y0, size_t y1)
+    {
+        const size_t w = m_width;
+        const float keep = 1.0f - m_evaporation;
+        const float self = keep * (1.0f - m_diffusion);
+        const float nbr  = keep * m_diffusion * 0.25f;
+
+        for (size_t y = y0; y < y1; y++)
+        {
+            const float * up   = &m_values[(y == 0 ? y : y - 1) * w];
+            const float * row  = &m_values[y * w];
+            const float * down = &m_values[(y + 1 == m_height ? y : y + 1) * w];
+            float * out        = &m_next[y * w];
+
+            // first column has no left neighbour
+            out[0] = self * row[0] + nbr * ((row[0] + row[w > 1 ? 1 : 0]) + (up[0] + down[0]));
+            if (w == 1) { continue; }
+
+            size_t x = 1;
+        #ifdef CWAGGLE_DYNAMIC_GRID_SSE
+            const __m128 vSelf = _mm_set1_ps(self);
+            const __m128 vNbr  = _mm_set1_ps(nbr);
+            for (; x + 4 < w; x += 4)
+            {
+                __m128 lr = _mm_add_ps(_mm_loadu_ps(row + x - 1), _mm_loadu_ps(row + x + 1));
+                __m128 ud = _mm_add_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x));
+                __m128 c  = _mm_loadu_ps(row + x);
+                _mm_storeu_ps(out + x, _mm_add_ps(_mm_mul_ps(vSelf, c), _mm_mul_ps(vNbr, _mm_add_ps(lr, ud))));
+            }
+        #endif
+            for (; x + 1 < w; x++)
+            {
+                out[x] = self * row[x] + nbr * ((row[x - 1] + row[x + 1]) + (up[x] + down[x]));
+            }
+
+            // last column has no right neighbour
+            out[w - 1] = self * row[w - 1] + nbr * ((row[w - 2] + row[w - 1]) + (up[w - 1] + down[w - 1]));
+        }
+    }
+
+    // deposits are sorted first so the result doesn't depend on which thread added them first
+    void applyDeposits()
+    {
+        std::lock_guard<std::mutex> lock(m_depositMutex);
+        std::sort(m_deposits.begin(), m_deposits.end());
+        for (auto & d : m_deposits) { m_values[d.index] += d.amount; }
+        m_deposits.clear();
+    }
+
+public:
+
+    DynamicGrid(size_t width, size_t height, double diffusion, double evaporation, size_t updateSkip = 1)
+        : m_width(width)
+        , m_height(height)
+        , m_diffusion((float)diffusion)
+        , m_evaporation((float)evaporation)
+        , m_updateSkip(std::max<size_t>(updateSkip, 1))
+        , m_values(width * height, 0.0f)
+        , m_next(width * height, 0.0f)
+    {
+    }
+
+    // split the stencil across a thread pool, by bands of rows
+    void setThreadPool(std::shared_ptr<ThreadPool> pool)
+    {
+        m_pool = pool;
+    }
+
+    // adds to a cell at the start of the next tick, safe to call from any thread
+    void deposit(size_t x, size_t y, double amount)
+    {
+        if (x >= m_width || y >= m_height) { return; }
+        std::lock_guard<std::mutex> lock(m_depositMutex);
+        m_deposits.push_back({ y * m_width + x, (float)amount });
+    }
+
+    // adds to the cell under a world position
+    void depositAt(const Vec2 & pos, double worldWidth, double worldHeight, double amount)
+    {
+        if (pos.x < 0 || pos.y < 0) { return; }
+        deposit((size_t)(m_width * pos.x / worldWidth), (size_t)(m_height * pos.y / worldHeight), amount);
+    }
+
+    // called once per simulator tick: applies pending deposits, then runs the
+    // stencil if this is one of the ticks on which the field updates
+    void update(size_t step)
+    {
+        applyDeposits();
+        if (step % m_updateSkip != 0 || m_values.empty()) { return; }
+
+        if (m_pool)
+        {
+            m_pool->parallelFor(m_height, [&](size_t begin, size_t end, size_t) { stencilRows(begin, end); });
+        }
+        else
+        {
+            stencilRows(0, m_height);
+        }
+
+        m_values.swap(m_next);
+    }
+
+    inline double get(size_t x, size_t y) const
+    {
+        if (x >= m_width || y >= m_height) { return 0; }
+        return m_values[y * m_width + x];
+    }
+
+    // value of the cell under a world position
+    inline double getAt(const Vec2 & pos, double worldWidth, double worldHeight) const
+    {
+        if (pos.x < 0 || pos.y < 0) { return 0; }
+        return get((size_t)(m_width * pos.x / worldWidth), (size_t)(m_height * pos.y / worldHeight));
+    }
+
+    void clear()
+    {
+        std::fill(m_values.begin(), m_values.end(), 0.0f);
+    }
+
+    const std::vector<float> & values() const
+    {
+        return m_values;
+    }
+
+    // replaces every value, for restoring a saved field
+    void setValues(const std::vector<float> & values)
+    {
+        if (values.size() == m_values.size()) { m_values = values; }
+    }
+
+    size_t width() const
+    {
+        return m_width;
+    }
+
+    size_t height() const
+    {
+        return m_height;
+    }
+};
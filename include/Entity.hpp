@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <vector>
+#include <atomic>
 
 class EntityManager;
 
@@ -9,7 +10,7 @@ class EntityManager;
 
 inline size_t GetComponentTypeID()
 {
-    static size_t lastID = 0;
+    static std::atomic<size_t> lastID(0);
     return lastID++;
 }
 
@@ -54,7 +55,7 @@ public:
 
     bool isActive()
     {
-        return EntityMemoryPool::Instance().getActive()[m_id];
+        return EntityMemoryPool::Instance().getActive()[m_id] != 0;
     }
 
     void setActive(bool active)
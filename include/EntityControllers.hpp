@@ -5,6 +5,18 @@
 #include "EntityAction.hpp"
 #include "SensorTools.hpp"
 
+// Control-rate decimation: a robot senses and decides every controlSkip
+// physics steps and holds its last action in between. Robot r decides on the
+// steps where step + r is a multiple of controlSkip, which spreads the robots
+// evenly over the phases so every step does a similar share of the deciding
+namespace ControlRate
+{
+    inline bool Decides(size_t step, size_t robot, size_t controlSkip)
+    {
+        return controlSkip <= 1 || (step + robot) % controlSkip == 0;
+    }
+}
+
 class EntityController
 {
 protected:
@@ -103,6 +103,10 @@ public:
     std::vector<Entity> & getEntities(const std::string & tag)
     {
         // return the vector in the map where all the entities with the same tag live
+        // look the tag up first so that concurrent readers (sensors running on
+        // worker threads) never insert into the map for tags that already exist
+        auto it = m_entityMap.find(tag);
+        if (it != m_entityMap.end()) { return it->second; }
         return m_entityMap[tag];
     }
 };
\ No newline at end of file
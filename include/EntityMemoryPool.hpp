@@ -4,6 +4,8 @@
 
 #include <iostream>
 #include <vector>
+#include <mutex>
+#include <atomic>
 
 const size_t MaxEntities = 20000;
 const size_t MaxComponents = 32;
@@ -17,7 +19,8 @@ typedef std::tuple <
     std::vector<CSensorArray>,
     std::vector<CRobotType>,
     std::vector<CSteer>,
-    std::vector<CColor>
+    std::vector<CColor>,
+    std::vector<CFieldDeposit>
 > EntityData;
 
 class EntityMemoryPool
@@ -27,10 +30,12 @@ class EntityMemoryPool
     size_t      m_previousEntityIndex = 0;
 
     std::vector<std::string>    m_tags;
-    std::vector<bool>           m_active;
+    std::vector<std::atomic<char>> m_active;    // atomic so worlds on other threads can add and remove entities
+    std::mutex                  m_addMutex;
     std::vector<std::bitset<MaxComponents>> m_hasComponent;
 
     EntityMemoryPool()
+        : m_active(MaxEntities)
     {
         getData<CTransform>().resize(MaxEntities);
         getData<CCircleBody>().resize(MaxEntities);
@@ -41,9 +46,10 @@ class EntityMemoryPool
         getData<CRobotType>().resize(MaxEntities);
         getData<CController>().resize(MaxEntities);
         getData<CColor>().resize(MaxEntities);
+        getData<CFieldDeposit>().resize(MaxEntities);
         m_hasComponent.resize(MaxEntities);
         m_tags.resize(MaxEntities);
-        m_active.resize(MaxEntities);
+        for (auto & active : m_active) { active = 0; }
     }
 
     size_t getNextEntityIndex()
@@ -73,8 +79,11 @@ public:
         return instance;
     }
 
+    // safe to call from several threads, each building its own world
     inline size_t addEntity(const std::string & tag)
     {
+        std::lock_guard<std::mutex> lock(m_addMutex);
+
         // look for the next index that contains an inactive entity
         size_t entityIndex = getNextEntityIndex();
         
@@ -87,6 +96,7 @@ public:
         getData<CRobotType>()[entityIndex]    = {};
         getData<CController>()[entityIndex]   = {};
         getData<CSteer>()[entityIndex]        = {};
+        getData<CFieldDeposit>()[entityIndex] = {};
         m_hasComponent[entityIndex]           = {};
         m_tags[entityIndex]                   = tag;
         m_active[entityIndex]                 = true;
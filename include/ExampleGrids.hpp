@@ -1,26 +1,39 @@
 #pragma once
 
+#include <map>
+#include <mutex>
+#include <memory>
+
 #include "ValueGrid.hpp"
 #include "Vec2.hpp"
 
 namespace ExampleGrids
 {
-    // populates a world with a grid of pucks
-    ValueGrid GetInverseCenterDistanceGrid(size_t width, size_t height)
+    // a grid whose value rises towards the center
+    // grids are immutable once built, so one grid of each size is cached and
+    // shared by every world that asks for it instead of being rebuilt per reset
+    std::shared_ptr<const ValueGrid> GetInverseCenterDistanceGrid(size_t width, size_t height)
     {
-        ValueGrid grid(width, height);
+        static std::map<std::pair<size_t, size_t>, std::shared_ptr<const ValueGrid>> cache;
+        static std::mutex cacheMutex;
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto & cached = cache[std::make_pair(width, height)];
+        if (cached) { return cached; }
+
+        auto grid = std::make_shared<ValueGrid>(width, height);
 
-        for (size_t x = 0; x < width; x++)
+        for (size_t y = 0; y < height; y++)
         {
-            for (size_t y = 0; y < height; y++)
+            for (size_t x = 0; x < width; x++)
             {
-                grid.set(x, y, Vec2(x, y).dist(Vec2(width / 2.0, height / 2.0)));
+                grid->set(x, y, Vec2(x, y).dist(Vec2(width / 2.0, height / 2.0)));
             }
         }
 
-        grid.normalize();
-        grid.invert();
-        grid.setImage();
-        return grid;
+        grid->normalize();
+        grid->invert();
+        cached = grid;
+        return cached;
     }
-};
\ No newline at end of file
+};
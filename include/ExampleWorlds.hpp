@@ -1,5 +1,7 @@
 #pragma once
 
+#include <random>
+
 #include "Simulator.hpp"
 #include "EntityControllers.hpp"
 #include "World.hpp"
@@ -86,7 +88,10 @@ namespace ExampleWorlds
         return world;
     }
 
-    std::shared_ptr<World> GetGetSquareWorld(size_t width, size_t height, size_t numRobots, double robotSize, size_t numPucks, double puckSize)
+    // robots and pucks are placed with the given random generator, so a world
+    // can be regenerated exactly from the generator's state
+    template <class RNG>
+    std::shared_ptr<World> GetGetSquareWorld(size_t width, size_t height, size_t numRobots, double robotSize, size_t numPucks, double puckSize, RNG & rng)
     {
         auto world = std::make_shared<World>(width, height);
 
@@ -94,7 +99,7 @@ namespace ExampleWorlds
         for (size_t r = 0; r < numRobots; r++)
         {
             Entity robot = world->addEntity("robot");
-            Vec2 rPos(rand() % width, rand() % height);
+            Vec2 rPos(rng() % width, rng() % height);
             robot.addComponent<CTransform>(rPos);
             robot.addComponent<CCircleBody>(robotSize);
             robot.addComponent<CCircleShape>(robotSize);
@@ -102,22 +107,22 @@ namespace ExampleWorlds
             robot.addComponent<CRobotType>(0);
 
             auto & sensors = robot.addComponent<CSensorArray>();
-            sensors.gridSensors.push_back(std::make_shared<GridSensor>(robot, 45, robotSize * 2));
-            sensors.gridSensors.push_back(std::make_shared<GridSensor>(robot, 0, robotSize * 2));
-            sensors.gridSensors.push_back(std::make_shared<GridSensor>(robot, -45, robotSize * 2));
-            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, -30, robotSize * 4, robotSize * 2));
-            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, 30, robotSize * 4, robotSize * 2));
-            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, 60, robotSize * 7, robotSize * 2));
-            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, -60, robotSize * 7, robotSize * 2));
-            sensors.obstacleSensors.push_back(std::make_shared<ObstacleSensor>(robot, 45, robotSize, robotSize/4));
-            sensors.obstacleSensors.push_back(std::make_shared<ObstacleSensor>(robot, -45, robotSize, robotSize/4));
+            sensors.gridSensors.push_back(std::make_shared<GridSensor>(robot, 45, robotSize * 2, "rightNest"));
+            sensors.gridSensors.push_back(std::make_shared<GridSensor>(robot, 0, robotSize * 2, "midNest"));
+            sensors.gridSensors.push_back(std::make_shared<GridSensor>(robot, -45, robotSize * 2, "leftNest"));
+            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, -30, robotSize * 4, robotSize * 2, "leftPucks"));
+            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, 30, robotSize * 4, robotSize * 2, "rightPucks"));
+            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, 60, robotSize * 7, robotSize * 2, "rightPucks"));
+            sensors.puckSensors.push_back(std::make_shared<PuckSensor>(robot, -60, robotSize * 7, robotSize * 2, "leftPucks"));
+            sensors.obstacleSensors.push_back(std::make_shared<ObstacleSensor>(robot, 45, robotSize, robotSize/4, "rightObstacle"));
+            sensors.obstacleSensors.push_back(std::make_shared<ObstacleSensor>(robot, -45, robotSize, robotSize/4, "leftObstacle"));
         }
 
         // add the pucks
         for (size_t r = 0; r < numPucks; r++)
         {
-            int rWidth = rand() % (int)(width - 8 * puckSize);
-            int rHeight = rand() % (int)(height - 8 * puckSize);
+            int rWidth = (int)(rng() % (size_t)(width - 8 * puckSize));
+            int rHeight = (int)(rng() % (size_t)(height - 8 * puckSize));
             Vec2 pPos(4*puckSize + rWidth, 4*puckSize + rHeight);
 
             Entity puck = world->addEntity("puck");
@@ -133,4 +138,45 @@ namespace ExampleWorlds
         world->update();
         return world;
     }
+
+    std::shared_ptr<World> GetGetSquareWorld(size_t width, size_t height, size_t numRobots, double robotSize, size_t numPucks, double puckSize)
+    {
+        std::mt19937 rng;
+        return GetGetSquareWorld(width, height, numRobots, robotSize, numPucks, puckSize, rng);
+    }
+
+    // gives a world a pheromone-style trail: a field of cellSize cells that
+    // every robot deposits amount into per unit of time, and senses just
+    // ahead of itself as an observation feature named after the field
+    // the field diffuses once every updateSkip ticks, split across pool if given
+    // call this before controllers look up the features they read
+    void AddTrailField(std::shared_ptr<World> world, const std::string & name, double cellSize, double diffusion, double evaporation, double amount,
+                       size_t updateSkip = 1, std::shared_ptr<ThreadPool> pool = nullptr)
+    {
+        size_t cellsX = (size_t)std::ceil(world->width() / cellSize);
+        size_t cellsY = (size_t)std::ceil(world->height() / cellSize);
+        auto field = std::make_shared<DynamicGrid>(cellsX, cellsY, diffusion, evaporation, updateSkip);
+        field->setThreadPool(pool);
+        world->addField(name, field);
+
+        for (auto robot : world->getEntities("robot"))
+        {
+            robot.addComponent<CFieldDeposit>(name, amount);
+            double robotSize = robot.getComponent<CCircleBody>().r;
+            robot.getComponent<CSensorArray>().fieldSensors.push_back(std::make_shared<FieldSensor>(robot, 0, robotSize * 2, name, name));
+        }
+    }
+
+    // gives every robot a fan of numRays range rays spread over fov degrees
+    // around its heading, each seeing up to maxRange and read as a feature
+    // named name[i]. no rays are added when numRays is 0
+    void AddRangeSensors(std::shared_ptr<World> world, const std::string & name, size_t numRays, double fov, double maxRange)
+    {
+        if (numRays == 0) { return; }
+
+        for (auto robot : world->getEntities("robot"))
+        {
+            robot.getComponent<CSensorArray>().rangeSensors.push_back(std::make_shared<RangeSensor>(robot, 0, fov, numRays, maxRange, name));
+        }
+    }
 };
\ No newline at end of file
@@ -38,6 +38,7 @@ class GUI
         //m_text.setFillColor(sf::Color::Yellow);
 
         // create the grid rectangle shapes
+        // the grid builds its render image the first time it is asked for it
         auto & grid = m_sim->getWorld()->getGrid();
         m_gridTexture.loadFromImage(grid.getImage());
         m_gridSprite = sf::Sprite(m_gridTexture);
@@ -228,6 +229,16 @@ class GUI
                 auto & sensors = robot.getComponent<CSensorArray>();
                 auto & c = robot.getComponent<CColor>();
 
+                for (auto & sensor : sensors.fieldSensors)
+                {
+                    sf::CircleShape sensorShape(sensorRadius, 32);
+                    sensorShape.setOrigin(sensorRadius, sensorRadius);
+                    Vec2 pos = sensor->getPosition();
+                    sensorShape.setPosition((float)pos.x, (float)pos.y);
+                    sensorShape.setFillColor(sf::Color::Green);
+                    m_window.draw(sensorShape);
+                }
+
                 for (auto & sensor : sensors.gridSensors)
                 {
                     sf::CircleShape sensorShape(sensorRadius, 32);
@@ -262,6 +273,19 @@ class GUI
                     m_window.draw(sensorShape);
                 }
 
+                for (auto & sensor : sensors.rangeSensors)
+                {
+                    auto & ranges = sensor->getRanges(m_sim->getWorld());
+                    const Vec2 & pos = robot.getComponent<CTransform>().p;
+                    double heading = robot.getComponent<CSteer>().angle;
+                    for (size_t i = 0; i < ranges.size(); i++)
+                    {
+                        double a = heading + sensor->rayAngle(i);
+                        Vec2 end = pos + Vec2(cos(a), sin(a)) * ranges[i];
+                        drawLine(pos, end, ranges[i] < sensor->maxRange() ? sf::Color(255, 255, 255, 120) : sf::Color(c.r, c.g, c.b, 80));
+                    }
+                }
+
             }
         }
 
@@ -295,13 +319,12 @@ class GUI
         if (m_selected != Entity() && m_selected.hasComponent<CSensorArray>())
         {
             auto & t = m_selected.getComponent<CTransform>();
-            SensorReading reading;
-            SensorTools::ReadSensorArray(m_selected, m_sim->getWorld(), reading);
+            auto & obs = SensorTools::ReadObservation(m_selected, m_sim->getWorld());
 
             sf::Text text;
             text.setFont(m_font);
             text.setCharacterSize(12);
-            text.setString(reading.toString());
+            text.setString(SensorTools::GetLayout(m_selected).toString(obs.data()));
             text.setPosition((float)t.p.x, (float)t.p.y);
             m_window.draw(text);
         }
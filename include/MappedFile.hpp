@@ -0,0 +1,165 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef WIN32   // Windows system specific
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else          // Unix based system specific
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// A file mapped into memory
+// Read-only mappings let many processes share the same physical pages, and
+// read-write mappings are shared, so stores become visible to every process
+// that maps the same file and are eventually written back to disk
+class MappedFile
+{
+    uint8_t *   m_data = nullptr;
+    size_t      m_size = 0;
+    bool        m_writable = false;
+
+    #ifdef WIN32
+        HANDLE  m_file = INVALID_HANDLE_VALUE;
+        HANDLE  m_mapping = NULL;
+    #else
+        int     m_fd = -1;
+    #endif
+
+public:
+
+    MappedFile() {}
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator = (const MappedFile &) = delete;
+
+    // maps an existing file read-only
+    bool openRead(const std::string & filename)
+    {
+        close();
+        m_writable = false;
+
+        #ifdef WIN32
+            m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_file == INVALID_HANDLE_VALUE) { return false; }
+            LARGE_INTEGER size;
+            GetFileSizeEx(m_file, &size);
+            m_size = (size_t)size.QuadPart;
+            if (m_size == 0) { close(); return false; }
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (m_mapping == NULL) { close(); return false; }
+            m_data = (uint8_t *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        #else
+            m_fd = ::open(filename.c_str(), O_RDONLY);
+            if (m_fd < 0) { return false; }
+            struct stat st;
+            if (fstat(m_fd, &st) != 0 || st.st_size == 0) { close(); return false; }
+            m_size = (size_t)st.st_size;
+            void * data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+            m_data = data == MAP_FAILED ? nullptr : (uint8_t *)data;
+        #endif
+
+        if (!m_data) { close(); return false; }
+        return true;
+    }
+
+    // maps a file read-write and shared, creating it or growing it to at least minSize bytes
+    // any bytes added to the file read as zero
+    bool openReadWrite(const std::string & filename, size_t minSize)
+    {
+        close();
+        m_writable = true;
+
+        #ifdef WIN32
+            m_file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_file == INVALID_HANDLE_VALUE) { return false; }
+            LARGE_INTEGER size;
+            GetFileSizeEx(m_file, &size);
+            m_size = (size_t)size.QuadPart < minSize ? minSize : (size_t)size.QuadPart;
+            if (m_size == 0) { close(); return false; }
+            m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)m_size >> 32), (DWORD)(m_size & 0xFFFFFFFF), NULL);
+            if (m_mapping == NULL) { close(); return false; }
+            m_data = (uint8_t *)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        #else
+            m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+            if (m_fd < 0) { return false; }
+            struct stat st;
+            if (fstat(m_fd, &st) != 0) { close(); return false; }
+            m_size = (size_t)st.st_size;
+            if (m_size < minSize)
+            {
+                if (ftruncate(m_fd, (off_t)minSize) != 0) { close(); return false; }
+                m_size = minSize;
+            }
+            if (m_size == 0) { close(); return false; }
+            void * data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+            m_data = data == MAP_FAILED ? nullptr : (uint8_t *)data;
+        #endif
+
+        if (!m_data) { close(); return false; }
+        return true;
+    }
+
+    // asks the OS to write dirty pages of a read-write mapping back to disk
+    void flush()
+    {
+        if (!m_data || !m_writable) { return; }
+
+        #ifdef WIN32
+            FlushViewOfFile(m_data, 0);
+        #else
+            msync(m_data, m_size, MS_ASYNC);
+        #endif
+    }
+
+    void close()
+    {
+        #ifdef WIN32
+            if (m_data) { UnmapViewOfFile(m_data); }
+            if (m_mapping != NULL) { CloseHandle(m_mapping); }
+            if (m_file != INVALID_HANDLE_VALUE) { CloseHandle(m_file); }
+            m_mapping = NULL;
+            m_file = INVALID_HANDLE_VALUE;
+        #else
+            if (m_data) { munmap(m_data, m_size); }
+            if (m_fd >= 0) { ::close(m_fd); }
+            m_fd = -1;
+        #endif
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    bool isOpen() const
+    {
+        return m_data != nullptr;
+    }
+
+    const uint8_t * data() const
+    {
+        return m_data;
+    }
+
+    // nullptr unless the file was mapped read-write
+    uint8_t * writableData()
+    {
+        return m_writable ? m_data : nullptr;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+};
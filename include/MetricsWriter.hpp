@@ -0,0 +1,252 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+
+#include "AtomicFile.hpp"
+#include "BackgroundWorker.hpp"
+
+// Records rows of named series and writes them to disk on a background thread
+// Rows are filled into blocks of blockRows rows. A full block is handed to
+// the writer thread and recording carries on in a block from a free list, so
+// the recording thread never waits on the disk; if the writer falls behind
+// new blocks are allocated rather than blocking. Blocks come back to the free
+// list once written, so a writer that keeps up cycles through the same few.
+//
+// Text files start with a '# name name ...' line, then one row per line,
+// which gnuplot reads directly. Binary files are columnar:
+//
+//   "CWMETRIC" uint32 version, uint32 numSeries, then each name NUL terminated
+//   then blocks of: uint64 rows, and each series' rows doubles in turn
+class MetricsWriter
+{
+public:
+
+    enum Format { Text, Binary };
+
+private:
+
+    struct Output
+    {
+        std::ofstream                       file;
+        uint64_t                            bytes = 0;      // written to file, only read once the writer is idle
+        Format                              format = Text;
+        size_t                              numSeries = 0;
+        std::mutex                          freeMutex;
+        std::vector<std::vector<double>>    freeBlocks;
+    };
+
+    std::vector<std::string>    m_names;
+    std::shared_ptr<Output>     m_output;
+    std::vector<double>         m_block;        // row major while recording
+    size_t                      m_rows = 0;
+    size_t                      m_blockRows = 4096;
+    size_t                      m_blocksAllocated = 0;
+    BackgroundWorker            m_writer;
+
+    static void WriteBlock(Output & out, const std::vector<double> & block, size_t rows)
+    {
+        if (out.format == Text)
+        {
+            std::string text;
+            char number[32];
+            for (size_t r = 0; r < rows; r++)
+            {
+                for (size_t s = 0; s < out.numSeries; s++)
+                {
+                    snprintf(number, sizeof(number), s ? " %.10g" : "%.10g", block[r * out.numSeries + s]);
+                    text += number;
+                }
+                text += "\n";
+            }
+            out.file.write(text.data(), text.size());
+            out.bytes += text.size();
+        }
+        else
+        {
+            // transpose into columns, so a reader can pull out one series
+            uint64_t numRows = rows;
+            std::vector<double> columns(rows * out.numSeries);
+            for (size_t r = 0; r < rows; r++)
+            {
+                for (size_t s = 0; s < out.numSeries; s++) { columns[s * rows + r] = block[r * out.numSeries + s]; }
+            }
+            out.file.write((const char *)&numRows, sizeof(numRows));
+            out.file.write((const char *)columns.data(), columns.size() * sizeof(double));
+            out.bytes += sizeof(numRows) + columns.size() * sizeof(double);
+        }
+        out.file.flush();
+    }
+
+    std::vector<double> takeFreeBlock()
+    {
+        std::lock_guard<std::mutex> lock(m_output->freeMutex);
+        if (m_output->freeBlocks.empty())
+        {
+            m_blocksAllocated++;
+            return std::vector<double>(m_blockRows * m_names.size());
+        }
+        std::vector<double> block = std::move(m_output->freeBlocks.back());
+        m_output->freeBlocks.pop_back();
+        return block;
+    }
+
+    // hands the filled rows to the writer thread
+    void submitBlock()
+    {
+        if (m_rows == 0 || !m_output) { return; }
+
+        auto output = m_output;
+        auto block = std::make_shared<std::vector<double>>(std::move(m_block));
+        size_t rows = m_rows;
+        m_writer.submit([output, block, rows]
+        {
+            WriteBlock(*output, *block, rows);
+            std::lock_guard<std::mutex> lock(output->freeMutex);
+            output->freeBlocks.push_back(std::move(*block));
+        });
+
+        m_block = takeFreeBlock();
+        m_rows = 0;
+        std::fill(m_block.begin(), m_block.begin() + m_names.size(), 0.0);
+    }
+
+public:
+
+    MetricsWriter() {}
+
+    ~MetricsWriter()
+    {
+        close();
+    }
+
+    MetricsWriter(const MetricsWriter &) = delete;
+    MetricsWriter & operator = (const MetricsWriter &) = delete;
+
+    // adds a series and returns its column, every series must be added before open
+    size_t addSeries(const std::string & name)
+    {
+        m_names.push_back(name);
+        return m_names.size() - 1;
+    }
+
+    // resumeBytes continues a file written earlier rather than starting a new
+    // one, cutting it back to its first resumeBytes bytes, see bytesWritten
+    // and AtomicFile::TruncateTo
+    bool open(const std::string & filename, Format format = Text, size_t blockRows = 4096, uint64_t resumeBytes = 0)
+    {
+        close();
+
+        if (resumeBytes && !AtomicFile::TruncateTo(filename, resumeBytes, "metrics file"))
+        {
+            return false;
+        }
+
+        auto output = std::make_shared<Output>();
+        output->format    = format;
+        output->numSeries = m_names.size();
+        std::ios::openmode mode = std::ios::out | (resumeBytes ? std::ios::app : std::ios::trunc);
+        if (format == Binary) { mode |= std::ios::binary; }
+        output->file.open(filename, mode);
+        if (!output->file.good())
+        {
+            std::cerr << "Could not open metrics file: " << filename << "\n";
+            return false;
+        }
+
+        if (resumeBytes)
+        {
+            output->bytes = resumeBytes;
+        }
+        else if (format == Text)
+        {
+            output->file << "#";
+            for (auto & name : m_names) { output->file << " " << name; }
+            output->file << "\n";
+        }
+        else
+        {
+            uint32_t version = 1, numSeries = (uint32_t)m_names.size();
+            output->file.write("CWMETRIC", 8);
+            output->file.write((const char *)&version, sizeof(version));
+            output->file.write((const char *)&numSeries, sizeof(numSeries));
+            for (auto & name : m_names) { output->file.write(name.c_str(), name.size() + 1); }
+        }
+        output->file.flush();
+        if (!resumeBytes) { output->bytes = (uint64_t)output->file.tellp(); }
+
+        m_output    = output;
+        m_blockRows = blockRows ? blockRows : 1;
+        m_block     = takeFreeBlock();
+        m_rows      = 0;
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return m_output != nullptr;
+    }
+
+    // sets a series in the row being recorded, series not set in a row are 0
+    inline void set(size_t series, double value)
+    {
+        m_block[m_rows * m_names.size() + series] = value;
+    }
+
+    // finishes the row being recorded and starts the next one
+    inline void commit()
+    {
+        if (++m_rows == m_blockRows) { submitBlock(); return; }
+        std::fill(m_block.begin() + m_rows * m_names.size(), m_block.begin() + (m_rows + 1) * m_names.size(), 0.0);
+    }
+
+    // hands any recorded rows to the writer without waiting for them
+    void flush()
+    {
+        submitBlock();
+    }
+
+    // writes every recorded row, waiting until they are on disk
+    void sync()
+    {
+        submitBlock();
+        m_writer.wait();
+    }
+
+    // the length of the file once every row recorded so far is written,
+    // a file reopened with this many resume bytes carries on from here
+    uint64_t bytesWritten()
+    {
+        sync();
+        return m_output ? m_output->bytes : 0;
+    }
+
+    // writes every recorded row and closes the file
+    void close()
+    {
+        if (!m_output) { return; }
+        submitBlock();
+        m_writer.wait();
+        m_output.reset();
+        m_block.clear();
+    }
+
+    // blocks allocated because none was free, a sign the disk is falling behind
+    size_t blocksAllocated() const
+    {
+        return m_blocksAllocated;
+    }
+
+    const std::vector<std::string> & seriesNames() const
+    {
+        return m_names;
+    }
+};
@@ -1,59 +1,156 @@
 #pragma once
 
 #include <sstream>
+#include <map>
 
 #include "Entity.hpp"
 #include "World.hpp"
 #include "Sensors.hpp"
 
-struct SensorReading
+// Describes the meaning of each slot in a robot's observation vector
+// Every sensor writes into the slot with its name, so sensors that share a
+// name are deliberately summed together (e.g. two puck sensors on the left side
+// both named "leftPucks") while unnamed sensors each get a slot of their own
+class SensorLayout
 {
-    double leftNest = 0;
-    double midNest = 0;
-    double rightNest = 0;
-    double leftPucks = 0;
-    double rightPucks = 0;
-    double leftObstacle = 0;
-    double rightObstacle = 0;
+    std::vector<std::string>        m_names;
+    std::map<std::string, size_t>   m_index;
 
-    std::string toString()
+public:
+
+    static const size_t npos = (size_t)-1;
+
+    SensorLayout() {}
+
+    // returns the slot for the given name, adding a new one if it doesn't exist
+    size_t add(const std::string & name)
+    {
+        auto it = m_index.find(name);
+        if (it != m_index.end()) { return it->second; }
+
+        m_index[name] = m_names.size();
+        m_names.push_back(name);
+        return m_names.size() - 1;
+    }
+
+    // returns the slot for the given name, or npos if there is no such feature
+    size_t index(const std::string & name) const
+    {
+        auto it = m_index.find(name);
+        return it == m_index.end() ? npos : it->second;
+    }
+
+    const std::string & name(size_t index) const
+    {
+        return m_names[index];
+    }
+
+    size_t size() const
+    {
+        return m_names.size();
+    }
+
+    bool operator == (const SensorLayout & rhs) const
+    {
+        return m_names == rhs.m_names;
+    }
+
+    std::string toString(const double * values) const
     {
         std::stringstream ss;
-        ss << "lNest: " << leftNest << "\n";
-        ss << "mNest: " << midNest << "\n";
-        ss << "rNest: " << rightNest << "\n";
-        ss << "lPuck: " << leftPucks << "\n";
-        ss << "rPuck: " << rightPucks << "\n";
-        ss << "lObst: " << leftObstacle << "\n";
-        ss << "rObst: " << rightObstacle;
+        for (size_t i = 0; i < m_names.size(); i++)
+        {
+            ss << (i ? "\n" : "") << m_names[i] << ": " << values[i];
+        }
         return ss.str();
     }
 };
 
 namespace SensorTools
 {
-    inline void ReadSensorArray(Entity e, std::shared_ptr<World> world, SensorReading & reading)
+    inline size_t NumSensors(const CSensorArray & sensors)
     {
-        reading = {};
+        size_t numRays = 0;
+        for (auto & sensor : sensors.rangeSensors) { numRays += sensor->numRays(); }
+
+        return sensors.gridSensors.size() + sensors.puckSensors.size() + sensors.obstacleSensors.size()
+             + sensors.fieldSensors.size() + numRays;
+    }
 
+    // returns the layout of a robot's observation vector, building it from the
+    // robot's sensors the first time it is needed or if sensors were added since
+    inline const SensorLayout & GetLayout(Entity e)
+    {
         auto & sensors = e.getComponent<CSensorArray>();
-        for (auto & sensor : sensors.gridSensors)
+        if (sensors.layout && sensors.featureIndex.size() == NumSensors(sensors))
         {
-            if (sensor->angle() < 0) { reading.leftNest = sensor->getReading(world); }
-            if (sensor->angle() > 0) { reading.rightNest = sensor->getReading(world); }
-            if (sensor->angle() == 0) { reading.midNest = sensor->getReading(world); }
+            return *sensors.layout;
         }
-        for (auto & sensor : sensors.obstacleSensors)
+
+        auto layout = std::make_shared<SensorLayout>();
+        sensors.featureIndex.clear();
+        sensors.observationStep = (size_t)-1;
+
+        // sensors without a name get a unique one so they are never folded together
+        auto addSensor = [&](const std::string & name, const std::string & prefix, size_t number)
+        {
+            std::string slotName = name.empty() ? prefix + std::to_string(number) : name;
+            sensors.featureIndex.push_back(layout->add(slotName));
+        };
+
+        for (size_t i = 0; i < sensors.gridSensors.size(); i++)     { addSensor(sensors.gridSensors[i]->name(), "grid", i); }
+        for (size_t i = 0; i < sensors.puckSensors.size(); i++)     { addSensor(sensors.puckSensors[i]->name(), "puck", i); }
+        for (size_t i = 0; i < sensors.obstacleSensors.size(); i++) { addSensor(sensors.obstacleSensors[i]->name(), "obstacle", i); }
+        for (size_t i = 0; i < sensors.fieldSensors.size(); i++)    { addSensor(sensors.fieldSensors[i]->name(), "field", i); }
+        for (size_t i = 0; i < sensors.rangeSensors.size(); i++)
         {
-            if (sensor->angle() <= 0) { reading.leftObstacle += sensor->getReading(world); }
-            if (sensor->angle() > 0) { reading.rightObstacle += sensor->getReading(world); }
+            auto & sensor = sensors.rangeSensors[i];
+            std::string base = sensor->name().empty() ? "range" + std::to_string(i) : sensor->name();
+            for (size_t r = 0; r < sensor->numRays(); r++)
+            {
+                addSensor(base + "[" + std::to_string(r) + "]", "", 0);
+            }
         }
-        for (auto & sensor : sensors.puckSensors)
+
+        sensors.layout = layout;
+        return *layout;
+    }
+
+    // returns the robot's observation vector for the current world step
+    // the vector lives in the robot's sensor array and is only rewritten once
+    // per step, so callers can hold on to it and read it directly
+    inline const std::vector<double> & ReadObservation(Entity e, std::shared_ptr<World> world)
+    {
+        auto & sensors = e.getComponent<CSensorArray>();
+        const SensorLayout & layout = GetLayout(e);
+        if (sensors.observationStep == world->getStep()) { return sensors.observation; }
+
+        auto & obs = sensors.observation;
+        obs.assign(layout.size(), 0.0);
+
+        size_t f = 0;
+        for (auto & sensor : sensors.gridSensors)     { obs[sensors.featureIndex[f++]] += sensor->getReading(world); }
+        for (auto & sensor : sensors.puckSensors)     { obs[sensors.featureIndex[f++]] += sensor->getReading(world); }
+        for (auto & sensor : sensors.obstacleSensors) { obs[sensors.featureIndex[f++]] += sensor->getReading(world); }
+        for (auto & sensor : sensors.fieldSensors)    { obs[sensors.featureIndex[f++]] += sensor->getReading(world); }
+        for (auto & sensor : sensors.rangeSensors)
         {
-            if (sensor->angle() <= 0) { reading.leftPucks += sensor->getReading(world); }
-            if (sensor->angle() > 0) { reading.rightPucks += sensor->getReading(world); }
+            for (double range : sensor->getRanges(world)) { obs[sensors.featureIndex[f++]] += range; }
         }
+
+        sensors.observationStep = world->getStep();
+        return obs;
     }
 
-    
-}
\ No newline at end of file
+    // looks up a feature that a controller or hash function cannot work without
+    inline size_t RequireFeature(const SensorLayout & layout, const std::string & name)
+    {
+        size_t index = layout.index(name);
+        if (index == SensorLayout::npos)
+        {
+            std::cerr << "Sensor layout has no feature named: " << name << "\n";
+            exit(-1);
+        }
+        return index;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 #include "World.hpp"
 #include "Entity.hpp"
@@ -13,12 +14,19 @@ protected:
     size_t m_ownerID;         // entity that owns this sensor
     double m_angle = 0;     // angle sensor is placed w.r.t. owner heading
     double m_distance = 0;  // distance from center of owner
+    std::string m_name;     // observation feature this sensor writes to
+
+    size_t m_readingStep = (size_t)-1;  // world step at which m_reading was computed
+    double m_reading = 0;               // cached reading for m_readingStep
+
+    // computes the sensor value from the current world state
+    virtual double computeReading(std::shared_ptr<World> world) = 0;
 
 public:
 
     Sensor() {}
-    Sensor(size_t ownerID, double angle, double distance)
-        : m_ownerID(ownerID), m_angle(angle*3.1415926 / 180.0), m_distance(distance) { }
+    Sensor(size_t ownerID, double angle, double distance, const std::string & name = "")
+        : m_ownerID(ownerID), m_angle(angle*3.1415926 / 180.0), m_distance(distance), m_name(name) { }
 
     inline virtual Vec2 getPosition()
     {
@@ -37,7 +45,29 @@ public:
         return m_distance;
     }
 
-    virtual double getReading(std::shared_ptr<World> world) = 0;
+    inline const std::string & name() const
+    {
+        return m_name;
+    }
+
+    // returns the reading for the current world step
+    // the value is computed at most once per simulator step and cached, so the
+    // controllers, RL code and GUI can all ask for it without recomputing it
+    inline double getReading(std::shared_ptr<World> world)
+    {
+        if (m_readingStep != world->getStep())
+        {
+            m_reading = computeReading(world);
+            m_readingStep = world->getStep();
+        }
+        return m_reading;
+    }
+
+    // forgets the cached reading, for when the world was changed without a step
+    inline void invalidate()
+    {
+        m_readingStep = (size_t)-1;
+    }
 };
 
 
@@ -46,16 +76,36 @@ class GridSensor : public Sensor
     
 public:
 
-    GridSensor(size_t ownerID, double angle, double distance)
-        : Sensor(ownerID, angle, distance) {}
+    GridSensor(size_t ownerID, double angle, double distance, const std::string & name = "")
+        : Sensor(ownerID, angle, distance, name) {}
+
+    inline virtual double computeReading(std::shared_ptr<World> world)
+    {
+        return world->sampleGrid(getPosition());
+    }
+};
+
+
+// Samples one of the world's dynamic fields, such as a pheromone trail
+class FieldSensor : public Sensor
+{
+    std::string m_field;
+    std::shared_ptr<DynamicGrid> m_grid;            // looked up again whenever the world's fields change
+    size_t m_gridVersion = (size_t)-1;
+
+public:
+
+    FieldSensor(size_t ownerID, double angle, double distance, const std::string & field, const std::string & name = "")
+        : Sensor(ownerID, angle, distance, name), m_field(field) {}
 
-    inline virtual double getReading(std::shared_ptr<World> world)
+    inline double computeReading(std::shared_ptr<World> world)
     {
-        if (world->getGrid().width() == 0) { return 0; }
-        Vec2 sPos = getPosition();
-        size_t gX = (size_t)round(world->getGrid().width()  * sPos.x / world->width());
-        size_t gY = (size_t)round(world->getGrid().height() * sPos.y / world->height());
-        return world->getGrid().get(gX, gY);
+        if (m_gridVersion != world->getFieldsVersion())
+        {
+            m_grid = world->getField(m_field);
+            m_gridVersion = world->getFieldsVersion();
+        }
+        return m_grid ? m_grid->getAt(getPosition(), world->width(), world->height()) : 0;
     }
 };
 
@@ -66,13 +116,13 @@ class PuckSensor : public Sensor
 
 public:
 
-    PuckSensor(size_t ownerID, double angle, double distance, double radius)
-        : Sensor(ownerID, angle, distance)
+    PuckSensor(size_t ownerID, double angle, double distance, double radius, const std::string & name = "")
+        : Sensor(ownerID, angle, distance, name)
     {
         m_radius = radius;
     }
 
-    inline double getReading(std::shared_ptr<World> world)
+    inline double computeReading(std::shared_ptr<World> world)
     {
         double sum = 0;
         Vec2 pos = getPosition();
@@ -103,13 +153,13 @@ class ObstacleSensor : public Sensor
 
 public:
 
-    ObstacleSensor(size_t ownerID, double angle, double distance, double radius)
-        : Sensor(ownerID, angle, distance)
+    ObstacleSensor(size_t ownerID, double angle, double distance, double radius, const std::string & name = "")
+        : Sensor(ownerID, angle, distance, name)
     {
         m_radius = radius;
     }
 
-    inline double getReading(std::shared_ptr<World> world)
+    inline double computeReading(std::shared_ptr<World> world)
     {
         double sum = 0;
         Vec2 pos = getPosition();
@@ -134,4 +184,87 @@ public:
     {
         return m_radius;
     }
-};
\ No newline at end of file
+};
+
+// Casts a fan of rays from the owner's center and measures the distance to the
+// nearest circle or line body along each ray, like a simple lidar
+// All rays of a sensor are evaluated together: the candidate bodies within
+// range are fetched once from the world's spatial index and then every ray is
+// tested against that short list
+class RangeSensor : public Sensor
+{
+    size_t              m_numRays = 1;
+    double              m_fov = 0;          // angular spread of the rays (radians)
+    double              m_maxRange = 0;     // distance reported when a ray hits nothing
+    std::vector<double> m_ranges;           // per-ray distances for m_readingStep
+    std::vector<size_t> m_candidates;       // scratch list of nearby shapes
+
+public:
+
+    // angle and fov are given in degrees, a 360 degree fov spaces rays evenly all around
+    // each ray is a separate observation feature named name[i]
+    RangeSensor(size_t ownerID, double angle, double fov, size_t numRays, double maxRange, const std::string & name = "")
+        : Sensor(ownerID, angle, 0, name)
+        , m_numRays(std::max<size_t>(numRays, 1))
+        , m_fov(fov * 3.1415926 / 180.0)
+        , m_maxRange(maxRange)
+        , m_ranges(m_numRays, maxRange)
+    {
+    }
+
+    // heading of ray i relative to the owner's heading
+    inline double rayAngle(size_t i) const
+    {
+        if (m_numRays == 1) { return m_angle; }
+        bool fullCircle = m_fov >= 2 * 3.1415926;
+        double step = m_fov / (fullCircle ? m_numRays : m_numRays - 1);
+        return m_angle - m_fov / 2 + step * i;
+    }
+
+    // computes every ray, stores them in m_ranges and returns the nearest hit
+    inline double computeReading(std::shared_ptr<World> world)
+    {
+        Vec2 origin = Entity(m_ownerID).getComponent<CTransform>().p;
+        double heading = Entity(m_ownerID).getComponent<CSteer>().angle;
+
+        const SpatialIndex & index = world->getSpatialIndex();
+        index.query(origin.x - m_maxRange, origin.y - m_maxRange, origin.x + m_maxRange, origin.y + m_maxRange, m_candidates);
+
+        double nearest = m_maxRange;
+        for (size_t i = 0; i < m_numRays; i++)
+        {
+            double a = heading + rayAngle(i);
+            Vec2 dir(cos(a), sin(a));
+
+            double range = m_maxRange;
+            for (size_t c : m_candidates)
+            {
+                auto & shape = index.getShape(c);
+                if (shape.id == m_ownerID) { continue; }
+                range = index.rayDistance(shape, origin, dir, range);
+            }
+
+            m_ranges[i] = range;
+            nearest = std::min(nearest, range);
+        }
+
+        return nearest;
+    }
+
+    // per-ray distances for the current step
+    inline const std::vector<double> & getRanges(std::shared_ptr<World> world)
+    {
+        getReading(world);
+        return m_ranges;
+    }
+
+    inline size_t numRays() const
+    {
+        return m_numRays;
+    }
+
+    inline double maxRange() const
+    {
+        return m_maxRange;
+    }
+};
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <memory>
 #include <algorithm>
+#include <random>
 
 #include "Vec2.hpp"
 #include "Timer.hpp"
@@ -40,6 +41,28 @@ class Simulator
 
     std::vector<Entity>         m_collisionEntities;
 
+    // the only randomness in the physics, owned here so runs can be reproduced
+    // and checkpointed, see getRNG
+    std::mt19937                m_rng;
+
+    // entities whose position changed during the last update, each listed
+    // once, so incremental metrics only have to look at these
+    std::vector<Entity>         m_movedEntities;
+    std::vector<char>           m_movedFlags;       // indexed by entity id
+
+    inline void markMoved(Entity e)
+    {
+        if (m_movedFlags[e.id()]) { return; }
+        m_movedFlags[e.id()] = 1;
+        m_movedEntities.push_back(e);
+    }
+
+    void clearMoved()
+    {
+        for (auto e : m_movedEntities) { m_movedFlags[e.id()] = 0; }
+        m_movedEntities.clear();
+    }
+
     void movement()
     {
         // update entity's velocity from its heading and angle
@@ -61,6 +84,7 @@ class Simulator
             auto & t = e.getComponent<CTransform>();
 
             if (t.v.length() < m_stoppingSpeed) { t.v = Vec2(0, 0); }
+            if (t.v.x != 0 || t.v.y != 0) { markMoved(e); }
             t.a = t.v * -m_deceleration;
             t.p += t.v * m_timeStep;
             t.v += t.a * m_timeStep;
@@ -136,6 +160,7 @@ class Simulator
                     t1.p.x += overlap * (t1.p.x - m_fakeTransforms.back().p.x) / distance;
                     t1.p.y += overlap * (t1.p.y - m_fakeTransforms.back().p.y) / distance;
                     b1.collided = true;
+                    markMoved(e1);
                 }
             }
             
@@ -165,8 +190,9 @@ class Simulator
                         // Circles are coincident.  If unchecked, this leads to
                         // division by zero below.  Arbitrarily perturb body 1
                         // by plus-or-minus 1 in x and y. 
-                        t1.p.x += 1 - (rand() % 3);
-                        t1.p.y += 1 - (rand() % 3);
+                        t1.p.x += 1 - (int)(m_rng() % 3);
+                        t1.p.y += 1 - (int)(m_rng() % 3);
+                        markMoved(e1);
                         continue;
                     }
 
@@ -179,8 +205,8 @@ class Simulator
                     Vec2 delta2 = (t1.p - t2.p) / dist * overlap * (b1.m / (b1.m + b2.m));
 
                     // apply the static collision resolution and record collision
-                    t1.p += delta1; b1.collided = true;
-                    t2.p -= delta2; b2.collided = true;
+                    t1.p += delta1; b1.collided = true; markMoved(e1);
+                    t2.p -= delta2; b2.collided = true; markMoved(e2);
                 }
             }
             // wraparound behavior
@@ -194,6 +220,7 @@ class Simulator
             if (t1.p.y - b1.r < 0) { t1.p.y = b1.r; b1.collided = true; }
             if (t1.p.x + b1.r > m_world->width()) { t1.p.x = m_world->width() - b1.r;  b1.collided = true; }
             if (t1.p.y + b1.r > m_world->height()) { t1.p.y = m_world->height() - b1.r; b1.collided = true; }
+            if (b1.collided) { markMoved(e1); }
         }
 
         // step 3: calculate and apply dynamic collision resolution to any detected collisions
@@ -239,6 +266,8 @@ public:
         m_fakeBodies.reserve(MaxEntities);
         m_fakeTransforms.reserve(MaxEntities);
         m_collisionEntities.reserve(MaxEntities);
+        m_movedEntities.reserve(MaxEntities);
+        m_movedFlags.assign(MaxEntities, 0);
     }
 
     void update(double timeStep = 1.0)
@@ -248,6 +277,8 @@ public:
         // update the world so entities get managed
         m_world->update();
 
+        clearMoved();
+
         // populate the vector of entities we care about colliding
         m_collisionEntities.clear();
         appendTo(m_world->getEntities("robot"), m_collisionEntities);
@@ -256,6 +287,12 @@ public:
         // do the actual simulation
         movement();
         collisions();
+
+        // deposit into and diffuse any dynamic fields
+        m_world->updateFields(timeStep);
+
+        // the world has changed, so any cached sensor readings are now stale
+        m_world->incrementStep();
     }
 
     // TODO: remove this, make sim world only on constructor
@@ -266,6 +303,19 @@ public:
         m_fakeTransforms.clear();
         m_fakeBodies.clear();
         m_collisionEntities.clear();
+        clearMoved();
+    }
+
+    // the generator used to separate coincident circles, seed it for reproducible runs
+    std::mt19937 & getRNG()
+    {
+        return m_rng;
+    }
+
+    // entities whose position changed during the last update
+    const std::vector<Entity> & getMovedEntities() const
+    {
+        return m_movedEntities;
     }
 
     std::vector<CollisionData> & getCollisions()
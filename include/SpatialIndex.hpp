@@ -0,0 +1,218 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "Vec2.hpp"
+#include "Entity.hpp"
+#include "Components.hpp"
+
+// A uniform grid over the world that buckets every circle and line body
+// It is rebuilt at most once per simulator step and then shared read-only by
+// every query made during that step, so sensors that need to find nearby
+// geometry don't have to loop over every entity in the world
+class SpatialIndex
+{
+public:
+
+    // a flattened copy of a body, lines are capsules of radius r from s to e
+    struct Shape
+    {
+        Vec2    s;
+        Vec2    e;
+        double  r = 0;
+        size_t  id = 0;
+        bool    isLine = false;
+    };
+
+private:
+
+    double m_cellSize = 32;
+    size_t m_cols = 0;
+    size_t m_rows = 0;
+
+    std::vector<Shape>  m_shapes;
+    std::vector<size_t> m_cellStart;    // cell c owns m_cellItems[m_cellStart[c], m_cellStart[c+1])
+    std::vector<size_t> m_cellItems;    // shape indices bucketed by cell
+    std::vector<size_t> m_cellCount;    // scratch used while building
+
+    inline size_t clampCol(double x) const
+    {
+        if (x < 0) { return 0; }
+        size_t c = (size_t)(x / m_cellSize);
+        return c < m_cols ? c : m_cols - 1;
+    }
+
+    inline size_t clampRow(double y) const
+    {
+        if (y < 0) { return 0; }
+        size_t r = (size_t)(y / m_cellSize);
+        return r < m_rows ? r : m_rows - 1;
+    }
+
+    // calls fn(cellIndex) for every cell overlapping the shape's bounding box
+    template <class F>
+    inline void forEachCell(const Shape & shape, F fn) const
+    {
+        size_t c0 = clampCol(std::min(shape.s.x, shape.e.x) - shape.r);
+        size_t c1 = clampCol(std::max(shape.s.x, shape.e.x) + shape.r);
+        size_t r0 = clampRow(std::min(shape.s.y, shape.e.y) - shape.r);
+        size_t r1 = clampRow(std::max(shape.s.y, shape.e.y) + shape.r);
+        for (size_t r = r0; r <= r1; r++)
+        {
+            for (size_t c = c0; c <= c1; c++)
+            {
+                fn(r * m_cols + c);
+            }
+        }
+    }
+
+public:
+
+    SpatialIndex() {}
+
+    // bucket every circle and line body of the given entities
+    // uses a counting pass then a fill pass so the buckets are one contiguous array
+    void build(std::vector<Entity> & entities, double width, double height, double cellSize)
+    {
+        m_cellSize = cellSize;
+        m_cols = std::max<size_t>(1, (size_t)ceil(width / cellSize));
+        m_rows = std::max<size_t>(1, (size_t)ceil(height / cellSize));
+
+        m_shapes.clear();
+        for (auto e : entities)
+        {
+            Shape shape;
+            shape.id = e.id();
+            if (e.hasComponent<CCircleBody>())
+            {
+                shape.s = shape.e = e.getComponent<CTransform>().p;
+                shape.r = e.getComponent<CCircleBody>().r;
+            }
+            else if (e.hasComponent<CLineBody>())
+            {
+                auto & line = e.getComponent<CLineBody>();
+                shape.s = line.s;
+                shape.e = line.e;
+                shape.r = line.r;
+                shape.isLine = true;
+            }
+            else { continue; }
+            m_shapes.push_back(shape);
+        }
+
+        m_cellCount.assign(m_cols * m_rows, 0);
+        for (auto & shape : m_shapes)
+        {
+            forEachCell(shape, [&](size_t c) { m_cellCount[c]++; });
+        }
+
+        m_cellStart.resize(m_cols * m_rows + 1);
+        m_cellStart[0] = 0;
+        for (size_t c = 0; c < m_cellCount.size(); c++)
+        {
+            m_cellStart[c + 1] = m_cellStart[c] + m_cellCount[c];
+            m_cellCount[c] = m_cellStart[c];
+        }
+
+        m_cellItems.resize(m_cellStart.back());
+        for (size_t i = 0; i < m_shapes.size(); i++)
+        {
+            forEachCell(m_shapes[i], [&](size_t c) { m_cellItems[m_cellCount[c]++] = i; });
+        }
+    }
+
+    // collects the indices of all shapes whose cells overlap the given box
+    // each shape appears once in the output, which is sorted by shape index
+    void query(double minX, double minY, double maxX, double maxY, std::vector<size_t> & out) const
+    {
+        out.clear();
+        if (m_shapes.empty()) { return; }
+
+        size_t c0 = clampCol(minX), c1 = clampCol(maxX);
+        size_t r0 = clampRow(minY), r1 = clampRow(maxY);
+        for (size_t r = r0; r <= r1; r++)
+        {
+            for (size_t c = c0; c <= c1; c++)
+            {
+                size_t cell = r * m_cols + c;
+                out.insert(out.end(), m_cellItems.begin() + m_cellStart[cell], m_cellItems.begin() + m_cellStart[cell + 1]);
+            }
+        }
+
+        // shapes spanning several cells were added once per cell
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    const Shape & getShape(size_t index) const
+    {
+        return m_shapes[index];
+    }
+
+    // distance along a ray (unit direction) to a circle, or maxDist if it misses
+    // a ray starting inside the circle hits it immediately
+    static inline double RayCircle(const Vec2 & origin, const Vec2 & dir, const Vec2 & center, double radius, double maxDist)
+    {
+        double ox = origin.x - center.x;
+        double oy = origin.y - center.y;
+        double c = ox * ox + oy * oy - radius * radius;
+        if (c <= 0) { return 0; }
+
+        double b = ox * dir.x + oy * dir.y;
+        if (b > 0) { return maxDist; }
+
+        double disc = b * b - c;
+        if (disc < 0) { return maxDist; }
+
+        double t = -b - sqrt(disc);
+        return t < maxDist ? t : maxDist;
+    }
+
+    // distance along a ray (unit direction) to a capsule, or maxDist if it misses
+    static inline double RayCapsule(const Vec2 & origin, const Vec2 & dir, const Vec2 & s, const Vec2 & e, double radius, double maxDist)
+    {
+        double best = std::min(RayCircle(origin, dir, s, radius, maxDist), RayCircle(origin, dir, e, radius, maxDist));
+        if (best == 0) { return 0; }
+
+        Vec2 seg = e - s;
+        double length = seg.length();
+        if (length == 0) { return best; }
+
+        Vec2 axis = seg / length;
+        Vec2 normal(-axis.y, axis.x);
+
+        // work in the capsule's frame: u along the segment, v across it
+        Vec2 rel = origin - s;
+        double u = rel.x * axis.x + rel.y * axis.y;
+        double v = rel.x * normal.x + rel.y * normal.y;
+        double du = dir.x * axis.x + dir.y * axis.y;
+        double dv = dir.x * normal.x + dir.y * normal.y;
+
+        // the origin is inside the rectangular body of the capsule
+        if (u >= 0 && u <= length && fabs(v) <= radius) { return 0; }
+
+        // intersect with whichever long side faces the origin
+        if (dv != 0)
+        {
+            double side = v > 0 ? radius : -radius;
+            double t = (side - v) / dv;
+            if (t >= 0 && t < best)
+            {
+                double hitU = u + t * du;
+                if (hitU >= 0 && hitU <= length) { best = t; }
+            }
+        }
+
+        return best;
+    }
+
+    // distance along a ray (unit direction) to a given shape
+    inline double rayDistance(const Shape & shape, const Vec2 & origin, const Vec2 & dir, double maxDist) const
+    {
+        return shape.isLine
+            ? RayCapsule(origin, dir, shape.s, shape.e, shape.r, maxDist)
+            : RayCircle(origin, dir, shape.s, shape.r, maxDist);
+    }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+// A small fixed-size pool used to split per-entity work across cores
+// The calling thread always takes part as thread 0, so a pool of size 1
+// creates no threads at all and simply runs the work inline
+class ThreadPool
+{
+    typedef std::function<void(size_t, size_t, size_t)> RangeFunction;
+
+    std::vector<std::thread>    m_threads;
+    std::mutex                  m_mutex;
+    std::condition_variable     m_startCondition;
+    std::condition_variable     m_doneCondition;
+
+    const RangeFunction *       m_function = nullptr;   // the work being done this round
+    size_t                      m_numItems = 0;         // number of items being split this round
+    size_t                      m_round = 0;            // incremented each time work is handed out
+    size_t                      m_working = 0;          // number of workers still busy this round
+    bool                        m_stop = false;
+
+    // the contiguous chunk of [0, numItems) handled by a given thread
+    // chunks are fixed for a given pool size so results are reproducible
+    inline void runChunk(size_t thread)
+    {
+        size_t begin = m_numItems * thread / size();
+        size_t end = m_numItems * (thread + 1) / size();
+        if (begin < end) { (*m_function)(begin, end, thread); }
+    }
+
+    void workerLoop(size_t thread)
+    {
+        size_t lastRound = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_startCondition.wait(lock, [&] { return m_stop || m_round != lastRound; });
+                if (m_stop) { return; }
+                lastRound = m_round;
+            }
+
+            runChunk(thread);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_working == 0) { m_doneCondition.notify_one(); }
+            }
+        }
+    }
+
+public:
+
+    ThreadPool(size_t numThreads = 1)
+    {
+        numThreads = std::max<size_t>(numThreads, 1);
+        for (size_t t = 1; t < numThreads; t++)
+        {
+            m_threads.emplace_back(&ThreadPool::workerLoop, this, t);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_startCondition.notify_all();
+        for (auto & thread : m_threads) { thread.join(); }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator = (const ThreadPool &) = delete;
+
+    size_t size() const
+    {
+        return m_threads.size() + 1;
+    }
+
+    // calls fn(begin, end, thread) once per thread over contiguous chunks of [0, numItems)
+    // returns once every chunk has been processed
+    void parallelFor(size_t numItems, const RangeFunction & fn)
+    {
+        if (numItems == 0) { return; }
+        if (m_threads.empty())
+        {
+            fn(0, numItems, 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_function = &fn;
+            m_numItems = numItems;
+            m_working = m_threads.size();
+            m_round++;
+        }
+        m_startCondition.notify_all();
+
+        runChunk(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCondition.wait(lock, [&] { return m_working == 0; });
+        m_function = nullptr;
+    }
+};
@@ -4,104 +4,488 @@
 #include <algorithm>
 #include <assert.h>
 #include <iostream>
+#include <fstream>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
 
 #include <SFML/Graphics.hpp>
 
+#include "Vec2.hpp"
+#include "MappedFile.hpp"
+
+// How a grid stores its cells
+// Every type reads and writes doubles through the same ValueGrid API, but the
+// integer types only hold values in [0,1], quantized to 1/255 or 1/65535
+// steps, and values outside that range are clamped when they are written
+enum class GridCellType : uint32_t
+{
+    Float64 = 0,
+    Float32 = 1,
+    UInt16  = 2,
+    UInt8   = 3
+};
+
+namespace GridCells
+{
+    inline size_t Size(GridCellType type)
+    {
+        switch (type)
+        {
+            case GridCellType::Float64: return sizeof(double);
+            case GridCellType::Float32: return sizeof(float);
+            case GridCellType::UInt16:  return sizeof(uint16_t);
+            case GridCellType::UInt8:   return sizeof(uint8_t);
+        }
+        return 0;
+    }
+
+    inline bool IsValid(uint32_t type)
+    {
+        return type <= (uint32_t)GridCellType::UInt8;
+    }
+
+    // exact decoded values of every uint8 cell, so decoding is a lookup
+    inline const double * UInt8Table()
+    {
+        struct Table
+        {
+            double values[256];
+            Table() { for (int i = 0; i < 256; i++) { values[i] = i / 255.0; } }
+        };
+        static const Table table;
+        return table.values;
+    }
+
+    inline double Decode(double v)   { return v; }
+    inline double Decode(float v)    { return v; }
+    inline double Decode(uint16_t v) { return v / 65535.0; }
+    inline double Decode(uint8_t v)  { return UInt8Table()[v]; }
+
+    inline double Quantize(double v, double max)
+    {
+        if (!(v > 0)) { return 0; }
+        if (v >= 1)   { return max; }
+        return std::floor(v * max + 0.5);
+    }
+
+    template <class T> inline T Encode(double v);
+    template <> inline double   Encode<double>(double v)   { return v; }
+    template <> inline float    Encode<float>(double v)    { return (float)v; }
+    template <> inline uint16_t Encode<uint16_t>(double v) { return (uint16_t)Quantize(v, 65535.0); }
+    template <> inline uint8_t  Encode<uint8_t>(double v)  { return (uint8_t)Quantize(v, 255.0); }
+}
+
+// Precomputed mapping from world positions to the cells of a grid
+// The scale factors are worked out once per grid and world, and positions
+// outside the world clamp to the border cells rather than wrapping through
+// size_t, so sampling is a multiply, an add and a clamp per axis
+struct GridTransform
+{
+    enum Rounding { Nearest, Floor };
+
+    size_t  width  = 0;         // grid size in cells
+    size_t  height = 0;
+    double  scaleX = 0;         // cells per world unit
+    double  scaleY = 0;
+    double  offset = 0;         // 0.5 rounds to the nearest cell, 0 floors
+    double  maxX   = 0;         // index of the last cell, as a double
+    double  maxY   = 0;
+
+    GridTransform() {}
+
+    GridTransform(size_t gridWidth, size_t gridHeight, double worldWidth, double worldHeight, Rounding rounding = Nearest)
+        : width(gridWidth)
+        , height(gridHeight)
+        , scaleX(worldWidth > 0 ? gridWidth / worldWidth : 0)
+        , scaleY(worldHeight > 0 ? gridHeight / worldHeight : 0)
+        , offset(rounding == Nearest ? 0.5 : 0.0)
+        , maxX(gridWidth > 0 ? (double)(gridWidth - 1) : 0)
+        , maxY(gridHeight > 0 ? (double)(gridHeight - 1) : 0)
+    {
+    }
+
+    // written so that NaN positions also land on cell 0
+    inline size_t cellX(double x) const
+    {
+        double c = x * scaleX + offset;
+        return !(c > 0) ? 0 : (c >= maxX ? (size_t)maxX : (size_t)c);
+    }
+
+    inline size_t cellY(double y) const
+    {
+        double c = y * scaleY + offset;
+        return !(c > 0) ? 0 : (c >= maxY ? (size_t)maxY : (size_t)c);
+    }
+
+    inline size_t cellIndex(const Vec2 & pos) const
+    {
+        return cellY(pos.y) * width + cellX(pos.x);
+    }
+};
+
+// Header of the native binary grid format
+// The cells follow at dataOffset as a row-major array of dtype values, in the
+// byte order of the machine that wrote the file, so a file can be mapped and
+// used as grid storage without any decoding
+struct ValueGridFileHeader
+{
+    char     magic[8];      // "CWGRID" padded with zeros
+    uint32_t version;
+    uint32_t dtype;         // one of GridCellType
+    uint64_t width;
+    uint64_t height;
+    uint64_t dataOffset;    // byte offset of the first cell from the start of the file
+
+    static const uint32_t CurrentVersion = 1;
+    static const uint64_t DataAlignment = 64;
+
+    static bool HasMagic(const char * bytes)
+    {
+        return memcmp(bytes, "CWGRID\0\0", 8) == 0;
+    }
+};
+
 class ValueGrid
 {
     size_t m_width = 0;
     size_t m_height = 0;
-    std::vector<double> m_values;
-    sf::Image m_image;
+    GridCellType m_type = GridCellType::Float64;
+    std::vector<uint64_t> m_storage;            // owned storage, as words so any cell type is aligned
+    std::shared_ptr<MappedFile> m_mapping;      // mapped storage, shared by copies of this grid
+    const uint8_t * m_data = nullptr;           // cells, pointing into one of the above
+
+    // greyscale render image, only built when something asks to draw the grid
+    mutable std::shared_ptr<sf::Image> m_image;
 
     inline size_t getIndex(size_t x, size_t y) const
     {
         return y * m_width + x;
     }
 
+    size_t numBytes() const
+    {
+        return m_width * m_height * GridCells::Size(m_type);
+    }
 
-public:
+    void allocate(size_t width, size_t height, GridCellType type)
+    {
+        m_width = width;
+        m_height = height;
+        m_type = type;
+        m_mapping.reset();
+        m_storage.assign((numBytes() + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        m_data = (const uint8_t *)m_storage.data();
+    }
 
-    ValueGrid() {}
-    ValueGrid(size_t width, size_t height, double value = 0.0)
-        : m_width(width), m_height(height), m_values(width*height, value)
+    // calls f with a typed pointer to the cells, so loops over the grid
+    // switch on the cell type once instead of once per cell
+    template <class F>
+    void visitCells(F f) const
     {
-        m_image.create(width, height, sf::Color::Black);
+        switch (m_type)
+        {
+            case GridCellType::Float64: f((const double *)m_data);   break;
+            case GridCellType::Float32: f((const float *)m_data);    break;
+            case GridCellType::UInt16:  f((const uint16_t *)m_data); break;
+            case GridCellType::UInt8:   f((const uint8_t *)m_data);  break;
+        }
     }
 
-    ValueGrid(const std::string & filename)
+    template <class F>
+    void visitWritableCells(F f)
     {
-        if (!m_image.loadFromFile(filename))
+        uint8_t * data = (uint8_t *)m_storage.data();
+        switch (m_type)
         {
-            std::cerr << "ValueGrid file not found: " << filename << "\n";
+            case GridCellType::Float64: f((double *)data);   break;
+            case GridCellType::Float32: f((float *)data);    break;
+            case GridCellType::UInt16:  f((uint16_t *)data); break;
+            case GridCellType::UInt8:   f((uint8_t *)data);  break;
+        }
+    }
+
+    // mapped grids are read-only, so copy the cells out before the first write
+    inline void makeWritable()
+    {
+        m_image.reset();
+        if (!m_mapping) { return; }
+        std::vector<uint64_t> storage((numBytes() + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        memcpy(storage.data(), m_data, numBytes());
+        m_storage.swap(storage);
+        m_mapping.reset();
+        m_data = (const uint8_t *)m_storage.data();
+    }
+
+    // decoded copy of every cell, used by the whole-grid operations
+    std::vector<double> getValues() const
+    {
+        std::vector<double> values(m_width * m_height);
+        visitCells([&](auto * cells)
+        {
+            for (size_t i = 0; i < values.size(); i++) { values[i] = GridCells::Decode(cells[i]); }
+        });
+        return values;
+    }
+
+    void setValues(const std::vector<double> & values)
+    {
+        makeWritable();
+        visitWritableCells([&](auto * cells)
+        {
+            typedef typename std::remove_pointer<decltype(cells)>::type T;
+            for (size_t i = 0; i < values.size(); i++) { cells[i] = GridCells::Encode<T>(values[i]); }
+        });
+    }
+
+    bool loadBinary(const std::string & filename)
+    {
+        auto mapping = std::make_shared<MappedFile>();
+        if (!mapping->openRead(filename) || mapping->size() < sizeof(ValueGridFileHeader)) { return false; }
+
+        ValueGridFileHeader header;
+        memcpy(&header, mapping->data(), sizeof(header));
+        if (!ValueGridFileHeader::HasMagic(header.magic)) { return false; }
+
+        if (header.version != ValueGridFileHeader::CurrentVersion || !GridCells::IsValid(header.dtype))
+        {
+            std::cerr << "ValueGrid file has unsupported version or dtype: " << filename << "\n";
             exit(-1);
         }
 
-        m_width = m_image.getSize().x;
-        m_height = m_image.getSize().y;
+        size_t cellSize = GridCells::Size((GridCellType)header.dtype);
+        if (header.dataOffset % cellSize != 0 || mapping->size() < header.dataOffset + header.width * header.height * cellSize)
+        {
+            std::cerr << "ValueGrid file is truncated or corrupt: " << filename << "\n";
+            exit(-1);
+        }
+
+        m_width = (size_t)header.width;
+        m_height = (size_t)header.height;
+        m_type = (GridCellType)header.dtype;
+        m_storage.clear();
+        m_mapping = mapping;
+        m_data = m_mapping->data() + header.dataOffset;
+        return true;
+    }
+
+    static bool IsBinaryFile(const std::string & filename)
+    {
+        char magic[8] = {};
+        std::ifstream fin(filename, std::ios::binary);
+        fin.read(magic, sizeof(magic));
+        return fin.good() && ValueGridFileHeader::HasMagic(magic);
+    }
+
+public:
 
-        m_values = std::vector<double>(m_width*m_height, 0);
+    ValueGrid() {}
+    ValueGrid(size_t width, size_t height, double value = 0.0, GridCellType type = GridCellType::Float64)
+    {
+        allocate(width, height, type);
+        if (value != 0.0) { setValues(std::vector<double>(width * height, value)); }
+    }
 
-        for (size_t x = 0; x < m_width; x++)
+    // loads either a native binary grid, which is mapped rather than read and
+    // keeps the cell type it was saved with, or any image format SFML can
+    // decode, which is averaged into [0,1] and stored as the given type
+    ValueGrid(const std::string & filename, GridCellType imageType = GridCellType::UInt8)
+    {
+        if (IsBinaryFile(filename))
         {
-            for (size_t y = 0; y < m_height; y++)
+            if (!loadBinary(filename))
             {
-                auto c = m_image.getPixel(x, y);
-                set(x, y, ((c.r + c.g + c.b) / 3.0) / 255.0);
+                std::cerr << "ValueGrid file could not be mapped: " << filename << "\n";
+                exit(-1);
             }
+            return;
+        }
+
+        // the decoded image is only needed while the values are extracted
+        sf::Image image;
+        if (!image.loadFromFile(filename))
+        {
+            std::cerr << "ValueGrid file not found: " << filename << "\n";
+            exit(-1);
+        }
+
+        allocate(image.getSize().x, image.getSize().y, imageType);
+        std::vector<double> values(m_width * m_height, 0);
+
+        // the image pixels are RGBA bytes in the same row-major order as the grid
+        const sf::Uint8 * pixels = image.getPixelsPtr();
+        for (size_t i = 0; i < values.size(); i++, pixels += 4)
+        {
+            values[i] = ((pixels[0] + pixels[1] + pixels[2]) / 3.0) / 255.0;
         }
+        setValues(values);
     }
 
-    inline double get(size_t x, size_t y) const
+    ValueGrid(const ValueGrid & rhs)
     {
-        if (x < 0 || y < 0 || x >= m_width || y >= m_height) return 0;
-        size_t index = getIndex(x, y);
+        *this = rhs;
+    }
+
+    ValueGrid & operator = (const ValueGrid & rhs)
+    {
+        if (this == &rhs) { return *this; }
+        m_width = rhs.m_width;
+        m_height = rhs.m_height;
+        m_type = rhs.m_type;
+        m_storage = rhs.m_storage;
+        m_mapping = rhs.m_mapping;
+        m_data = m_mapping ? rhs.m_data : (const uint8_t *)m_storage.data();
+        m_image = rhs.m_image;
+        return *this;
+    }
 
-        if (index >= m_values.size()) return 0;
-        assert(index < m_values.size());
-        return m_values[index];
+    // returns a copy of this grid with its cells stored as another type
+    ValueGrid converted(GridCellType type) const
+    {
+        ValueGrid grid(m_width, m_height, 0.0, type);
+        grid.setValues(getValues());
+        return grid;
     }
 
-    void setImage()
+    // writes the grid in the native binary format so it can be mapped later
+    bool save(const std::string & filename) const
     {
-        for (size_t x = 0; x < m_width; x++)
+        ValueGridFileHeader header = {};
+        memcpy(header.magic, "CWGRID\0\0", 8);
+        header.version = ValueGridFileHeader::CurrentVersion;
+        header.dtype = (uint32_t)m_type;
+        header.width = m_width;
+        header.height = m_height;
+        header.dataOffset = ValueGridFileHeader::DataAlignment;
+
+        std::ofstream fout(filename, std::ios::binary);
+        std::vector<char> padding(header.dataOffset - sizeof(header), 0);
+        fout.write((const char *)&header, sizeof(header));
+        fout.write(padding.data(), padding.size());
+        fout.write((const char *)m_data, numBytes());
+        return fout.good();
+    }
+
+    inline double get(size_t x, size_t y) const
+    {
+        if (x >= m_width || y >= m_height) return 0;
+        size_t index = getIndex(x, y);
+
+        assert(index < m_width * m_height);
+        switch (m_type)
         {
-            for (size_t y = 0; y < m_height; y++)
-            {
-                sf::Uint8 pixel = (sf::Uint8)(get(x, y) * 255);
-                m_image.setPixel(x, y, sf::Color(pixel, pixel, pixel));
-            }
+            case GridCellType::Float64: return GridCells::Decode(((const double *)m_data)[index]);
+            case GridCellType::Float32: return GridCells::Decode(((const float *)m_data)[index]);
+            case GridCellType::UInt16:  return GridCells::Decode(((const uint16_t *)m_data)[index]);
+            case GridCellType::UInt8:   return GridCells::Decode(((const uint8_t *)m_data)[index]);
         }
+        return 0;
     }
 
     inline void set(size_t x, size_t y, double value)
     {
+        makeWritable();
         size_t index = getIndex(x, y);
-        assert(index < m_values.size());
-        m_values[index] = value;
+        assert(index < m_width * m_height);
+        visitWritableCells([&](auto * cells)
+        {
+            typedef typename std::remove_pointer<decltype(cells)>::type T;
+            cells[index] = GridCells::Encode<T>(value);
+        });
+    }
+
+    // value of the cell under a world position, see GridTransform
+    inline double sample(const Vec2 & pos, const GridTransform & transform) const
+    {
+        if (m_width == 0 || m_height == 0) { return 0; }
+        assert(transform.width == m_width && transform.height == m_height);
+        return get(transform.cellX(pos.x), transform.cellY(pos.y));
+    }
+
+    // samples many positions at once, writing one value per position into out
+    // the cell type is only dispatched on once for the whole batch
+    void sample(const Vec2 * positions, size_t count, const GridTransform & transform, double * out) const
+    {
+        if (m_width == 0 || m_height == 0)
+        {
+            std::fill(out, out + count, 0.0);
+            return;
+        }
+
+        assert(transform.width == m_width && transform.height == m_height);
+        visitCells([&](auto * cells)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i] = GridCells::Decode(cells[transform.cellIndex(positions[i])]);
+            }
+        });
     }
 
     inline void normalize()
     {
+        std::vector<double> values = getValues();
+        if (values.empty()) { return; }
+
         // max the min value a 0
-        auto minVal = *std::min_element(std::begin(m_values), std::end(m_values));
-        for (auto & val : m_values) { val -= minVal; }
-        
+        auto minVal = *std::min_element(std::begin(values), std::end(values));
+        for (auto & val : values) { val -= minVal; }
+
         // divide everything by the max value
-        auto maxVal = *std::max_element(std::begin(m_values), std::end(m_values));
+        auto maxVal = *std::max_element(std::begin(values), std::end(values));
 
-        if (maxVal == 0) { return; }
-        for (auto & val : m_values) {  val /= maxVal;  }
+        if (maxVal != 0)
+        {
+            for (auto & val : values) { val /= maxVal; }
+        }
+        setValues(values);
     }
 
     inline void invert()
     {
-        for (auto & val : m_values) { val = 1.0 - val; }
+        std::vector<double> values = getValues();
+        for (auto & val : values) { val = 1.0 - val; }
+        setValues(values);
     }
 
+    // returns the greyscale render image, building it the first time it is asked for
+    // the image is cached until the grid is next modified, and since it is
+    // built on demand this should only be called from the rendering thread
     const sf::Image & getImage() const
     {
-        return m_image;
+        if (!m_image)
+        {
+            m_image = std::make_shared<sf::Image>();
+            m_image->create(m_width, m_height, sf::Color::Black);
+            for (size_t y = 0; y < m_height; y++)
+            {
+                for (size_t x = 0; x < m_width; x++)
+                {
+                    sf::Uint8 pixel = (sf::Uint8)(get(x, y) * 255);
+                    m_image->setPixel(x, y, sf::Color(pixel, pixel, pixel));
+                }
+            }
+        }
+        return *m_image;
+    }
+
+    // true if the cells are a read-only mapping of a binary grid file
+    bool isMapped() const
+    {
+        return m_mapping != nullptr;
+    }
+
+    GridCellType cellType() const
+    {
+        return m_type;
+    }
+
+    // bytes used by the cells themselves
+    size_t memoryUsage() const
+    {
+        return numBytes();
     }
 
     size_t width() const
@@ -113,4 +497,4 @@ public:
     {
         return m_height;
     }
-};
\ No newline at end of file
+};
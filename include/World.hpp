@@ -3,10 +3,14 @@
 #include <vector>
 #include <cassert>
 #include <array>
+#include <mutex>
+#include <atomic>
 
 #include "Vec2.hpp"
 #include "Timer.hpp"
 #include "ValueGrid.hpp"
+#include "SpatialIndex.hpp"
+#include "DynamicGrid.hpp"
 
 #include "EntityManager.hpp"
 
@@ -15,15 +19,31 @@ class World
     // world properties
     double m_width = 1920; // width  of the world 
     double m_height = 1080; // height of the world 
+    size_t m_step = 0;      // number of simulator steps applied to this world
 
     EntityManager   m_entitiyManager;
-    ValueGrid       m_grid;
+
+    // grids are immutable and shared between worlds, see getGridForWriting
+    std::shared_ptr<const ValueGrid> m_grid = std::make_shared<const ValueGrid>();
+    std::shared_ptr<ValueGrid>       m_ownGrid;     // this world's private copy, once it has written
+    GridTransform                    m_gridTransform;
+
+    // named fields that change over time, updated by the simulator every tick
+    std::map<std::string, std::shared_ptr<DynamicGrid>> m_fields;
+    size_t m_fieldsVersion = 0;     // counts the fields added or replaced, so sensors know to look them up again
+
+    // spatial index of all bodies, rebuilt on demand once per step
+    SpatialIndex        m_index;
+    double              m_indexCellSize = 32;
+    std::atomic<size_t> m_indexStep;
+    std::mutex          m_indexMutex;
 
 public:
 
     World(double width, double height)
         : m_width(width)
         , m_height(height)
+        , m_indexStep((size_t)-1)
     {
         
     }
@@ -38,9 +58,58 @@ public:
         return m_entitiyManager.addEntity(tag);
     }
 
-    void setGrid(const ValueGrid & grid)
+    // shares the given grid with this world without copying it
+    void setGrid(std::shared_ptr<const ValueGrid> grid)
     {
         m_grid = grid;
+        m_gridTransform = GridTransform(m_grid->width(), m_grid->height(), m_width, m_height);
+    }
+
+    void setGrid(const ValueGrid & grid)
+    {
+        setGrid(std::make_shared<const ValueGrid>(grid));
+    }
+
+    // adds a field, or replaces the field of the same name
+    void addField(const std::string & name, std::shared_ptr<DynamicGrid> field)
+    {
+        m_fields[name] = field;
+        m_fieldsVersion++;
+    }
+
+    size_t getFieldsVersion() const
+    {
+        return m_fieldsVersion;
+    }
+
+    // returns the named field, or nullptr if the world has no such field
+    std::shared_ptr<DynamicGrid> getField(const std::string & name) const
+    {
+        auto it = m_fields.find(name);
+        return it == m_fields.end() ? nullptr : it->second;
+    }
+
+    const std::map<std::string, std::shared_ptr<DynamicGrid>> & getFields() const
+    {
+        return m_fields;
+    }
+
+    // advances every field by one tick, called by the simulator after physics
+    // entities with a CFieldDeposit first add to the field under them
+    void updateFields(double timeStep = 1.0)
+    {
+        if (m_fields.empty()) { return; }
+
+        for (auto e : getEntities())
+        {
+            if (!e.hasComponent<CFieldDeposit>()) { continue; }
+
+            auto & deposit = e.getComponent<CFieldDeposit>();
+            auto field = getField(deposit.field);
+            if (field) { field->depositAt(e.getComponent<CTransform>().p, m_width, m_height, deposit.amount * timeStep); }
+        }
+
+        for (auto & kv : m_fields) { kv.second->update(m_step); }
     }
 
     std::vector<Entity> & getEntities()
@@ -53,9 +122,76 @@ public:
         return m_entitiyManager.getEntities(tag);
     }
     
-    ValueGrid & getGrid()
+    const ValueGrid & getGrid() const
+    {
+        return *m_grid;
+    }
+
+    // returns a grid this world may modify (copy-on-write)
+    // the first call copies the shared grid, later calls reuse that private copy
+    ValueGrid & getGridForWriting()
+    {
+        if (!m_ownGrid || m_ownGrid != m_grid)
+        {
+            m_ownGrid = std::make_shared<ValueGrid>(*m_grid);
+            m_grid = m_ownGrid;
+        }
+        return *m_ownGrid;
+    }
+
+    // maps world positions to the nearest grid cell, clamped to the grid
+    const GridTransform & getGridTransform() const
+    {
+        return m_gridTransform;
+    }
+
+    // value of the grid cell nearest to a world position
+    double sampleGrid(const Vec2 & pos) const
+    {
+        return m_grid->sample(pos, m_gridTransform);
+    }
+
+    // sensors key their cached readings on this value, so it must be advanced
+    // whenever the world state changes as a result of a simulation step
+    void incrementStep()
+    {
+        m_step++;
+    }
+
+    size_t getStep() const
+    {
+        return m_step;
+    }
+
+    // only for restoring a saved world, which must carry on from the saved step
+    // the spatial index is rebuilt, but cached sensor readings are left to the caller
+    void setStep(size_t step)
+    {
+        m_step = step;
+        m_indexStep = (size_t)-1;
+    }
+
+    // returns the spatial index for the current step, building it if needed
+    // safe to call from many sensor threads at once, only the first one builds
+    const SpatialIndex & getSpatialIndex()
+    {
+        if (m_indexStep.load(std::memory_order_acquire) != m_step)
+        {
+            std::lock_guard<std::mutex> lock(m_indexMutex);
+            if (m_indexStep.load(std::memory_order_relaxed) != m_step)
+            {
+                m_index.build(getEntities(), m_width, m_height, m_indexCellSize);
+                m_indexStep.store(m_step, std::memory_order_release);
+            }
+        }
+        return m_index;
+    }
+
+    // cell size of the spatial index, ideally close to typical query extents
+    void setSpatialIndexCellSize(double cellSize)
     {
-        return m_grid;
+        m_indexCellSize = cellSize;
+        m_indexStep = (size_t)-1;
     }
 
     double width() const
@@ -0,0 +1,38 @@
+#include <iostream>
+#include <string>
+
+#include "ValueGrid.hpp"
+
+// Converts an image (any format SFML can decode) into the native binary
+// ValueGrid format, which is memory-mapped instead of decoded when loaded
+// The optional cell type trades precision for size: u8 (default), u16, f32 or f64
+int main(int argc, char ** argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        std::cerr << "Usage: cwaggle_gridconvert <input image> <output grid> [u8|u16|f32|f64]\n";
+        return -1;
+    }
+
+    std::string typeName = argc == 4 ? argv[3] : "u8";
+    GridCellType type = GridCellType::UInt8;
+    if      (typeName == "u8")  { type = GridCellType::UInt8; }
+    else if (typeName == "u16") { type = GridCellType::UInt16; }
+    else if (typeName == "f32") { type = GridCellType::Float32; }
+    else if (typeName == "f64") { type = GridCellType::Float64; }
+    else
+    {
+        std::cerr << "Unknown cell type: " << typeName << "\n";
+        return -1;
+    }
+
+    ValueGrid grid(argv[1], type);
+    if (!grid.save(argv[2]))
+    {
+        std::cerr << "Could not write grid file: " << argv[2] << "\n";
+        return -1;
+    }
+
+    std::cout << "Wrote " << grid.width() << "x" << grid.height() << " " << typeName << " grid to " << argv[2] << "\n";
+    return 0;
+}
@@ -5,27 +5,36 @@ class EntityController_OrbitalConstruction : public EntityController
 {
     std::shared_ptr<World> m_world;
     Entity          m_robot;
-    SensorReading   m_reading;
     double          m_threshold[2] = { 0.65, 0.8 };
 
+    // observation slots of the features this controller uses
+    size_t m_leftNest, m_midNest, m_rightNest;
+    size_t m_leftPucks, m_rightPucks, m_leftObstacle;
+
 public:
 
     EntityController_OrbitalConstruction(Entity robot, std::shared_ptr<World> world)
         : m_world(world)
         , m_robot(robot)
     {
-
+        auto & layout    = SensorTools::GetLayout(robot);
+        m_leftNest       = SensorTools::RequireFeature(layout, "leftNest");
+        m_midNest        = SensorTools::RequireFeature(layout, "midNest");
+        m_rightNest      = SensorTools::RequireFeature(layout, "rightNest");
+        m_leftPucks      = SensorTools::RequireFeature(layout, "leftPucks");
+        m_rightPucks     = SensorTools::RequireFeature(layout, "rightPucks");
+        m_leftObstacle   = SensorTools::RequireFeature(layout, "leftObstacle");
     }
 
     virtual EntityAction getAction()
     {
-        // read the sensors and store it in m_reading
-        SensorTools::ReadSensorArray(m_robot, m_world, m_reading);
+        // read the sensors into the robot's observation vector
+        auto & obs = SensorTools::ReadObservation(m_robot, m_world);
 
         const double MaxAngularSpeed = 0.3;
         const double ForwardSpeed = 2;
 
-        if (m_reading.leftObstacle > 0)
+        if (obs[m_leftObstacle] > 0)
         {
             m_previousAction = EntityAction(ForwardSpeed, MaxAngularSpeed);
             return m_previousAction;
@@ -34,7 +43,7 @@ public:
         size_t type = m_robot.getComponent<CRobotType>().type;
         bool innie = type == 1;
 
-        if (m_reading.rightNest >= m_reading.midNest && m_reading.midNest >= m_reading.leftNest)
+        if (obs[m_rightNest] >= obs[m_midNest] && obs[m_midNest] >= obs[m_leftNest])
         {
             // The gradient is in the desired orientation with the highest
             // sensed value to the right, then the centre value in the middle,
@@ -42,19 +51,19 @@ public:
 
             // These conditions steer in (for an innie) and out (for an outie)
             // to nudge a puck inwards or outwards.
-            if (innie && m_reading.rightPucks > 0)
+            if (innie && obs[m_rightPucks] > 0)
             {
                 m_previousAction = EntityAction(ForwardSpeed, MaxAngularSpeed);
                 return m_previousAction;
             }
-            else if (!innie && m_reading.leftPucks > 0)
+            else if (!innie && obs[m_leftPucks] > 0)
             {
                 m_previousAction = EntityAction(ForwardSpeed, -MaxAngularSpeed);
                 return m_previousAction;
             }
 
             // We now act to maintain the centre value at the desired isoline.
-            if (m_reading.midNest < m_threshold[type])
+            if (obs[m_midNest] < m_threshold[type])
             {
                 m_previousAction = EntityAction(ForwardSpeed, 0.3 * MaxAngularSpeed);
                 return m_previousAction;
@@ -65,7 +74,7 @@ public:
                 return m_previousAction;
             }
         }
-        else if (m_reading.midNest >= m_reading.rightNest && m_reading.midNest >= m_reading.leftNest)
+        else if (obs[m_midNest] >= obs[m_rightNest] && obs[m_midNest] >= obs[m_leftNest])
         {
             // We are heading uphill of the gradient, turn left to return to a
             // clockwise orbit.
@@ -89,6 +98,32 @@ void OrbitalConstructionExample(int argc, char ** argv)
     //auto world = ExampleWorlds::GetGridWorld720(2);
     auto world = ExampleWorlds::GetGetSquareWorld(800, 800, 20, 10, 250, 10);
 
+    // robot controllers and the trail field are run in parallel using one thread per core
+    auto pool = std::make_shared<ThreadPool>(std::thread::hardware_concurrency());
+
+    // how much pheromone each robot leaves behind per tick, 0 for no trail
+    // the trail is sensed as the robots' 'trail' feature, which this
+    // controller doesn't use, but other controllers can follow
+    double trailAmount = 0;
+    if (argc >= 4)
+    {
+        std::stringstream ss(argv[3]);
+        ss >> trailAmount;
+    }
+
+    // how many ticks pass between each diffusion of the trail
+    size_t trailUpdateSkip = 1;
+    if (argc >= 5)
+    {
+        std::stringstream ss(argv[4]);
+        ss >> trailUpdateSkip;
+    }
+
+    if (trailAmount > 0)
+    {
+        ExampleWorlds::AddTrailField(world, "trail", 4, 0.2, 0.01, trailAmount, trailUpdateSkip, pool);
+    }
+
     // add orbital controllers to all the robots
     for (auto e : world->getEntities("robot"))
     {
@@ -111,30 +146,53 @@ void OrbitalConstructionExample(int argc, char ** argv)
     // how many simulation ticks are peformed before each world render in the GUI
     double stepsPerRender = 1;
 
-    // read that value from console if it exists
-    if (argc == 2)
+    // how many simulation ticks each robot holds an action before deciding again
+    size_t controlSkip = 1;
+
+    // read those values from console if they exist
+    if (argc >= 2)
     {
         std::stringstream ss(argv[1]);
         ss >> stepsPerRender;
     }
+    if (argc >= 3)
+    {
+        std::stringstream ss(argv[2]);
+        ss >> controlSkip;
+    }
+
+    // the action each robot last decided on, carried out until it decides again
+    std::vector<EntityAction> heldActions(world->getEntities("robot").size());
+    size_t step = 0;
 
     // run the simulation and gui update() function in a loop
     while (true)
     {
-        for (size_t i = 0; i < stepsPerRender; i++)
+        for (size_t i = 0; i < stepsPerRender; i++, step++)
         {
-            // un-comment to update the robots with a sample controller
-            for (auto & robot : simulator->getWorld()->getEntities("robot"))
+            // update the robots with their controllers, split across the pool
+            // controllers only read the world and write their own robot's CSteer
+            auto & robots = simulator->getWorld()->getEntities("robot");
+            pool->parallelFor(robots.size(), [&](size_t begin, size_t end, size_t)
             {
-                // if the entity doesn't have a controller we can skip it
-                if (!robot.hasComponent<CController>()) { continue; }
-
-                // get the action that should be done for this entity
-                EntityAction action = robot.getComponent<CController>().controller->getAction();
-
-                // have the action apply its effects to the entity
-                action.doAction(robot, simulationTimeStep);
-            }
+                for (size_t r = begin; r < end; r++)
+                {
+                    Entity robot = robots[r];
+
+                    // if the entity doesn't have a controller we can skip it
+                    if (!robot.hasComponent<CController>()) { continue; }
+
+                    // get the action that should be done for this entity, on its
+                    // turn to decide, otherwise keep doing the one it decided on
+                    if (ControlRate::Decides(step, r, controlSkip))
+                    {
+                        heldActions[r] = robot.getComponent<CController>().controller->getAction();
+                    }
+
+                    // have the action apply its effects to the entity
+                    heldActions[r].doAction(robot, simulationTimeStep);
+                }
+            });
 
             // call the world physics simulation update
             // parameter = how much sim time should pass (default 1.0)
@@ -31,15 +31,20 @@ namespace Eval
 
     double PuckAvgThresholdDiff(std::shared_ptr<World> world, double t1, double t2)
     {
-        double sum = 0;
         auto & grid = world->getGrid();
-        for (auto e : world->getEntities("puck"))
-        {
-            auto & t = e.getComponent<CTransform>();
-            size_t gridX = (size_t)(grid.width() * (t.p.x / world->width()));
-            size_t gridY = (size_t)(grid.height() * (t.p.y / world->height()));
-            double gridVal = grid.get(gridX, gridY);
+        auto & pucks = world->getEntities("puck");
+
+        // evaluation has always used the cell a puck is in rather than the nearest one
+        GridTransform transform(grid.width(), grid.height(), world->width(), world->height(), GridTransform::Floor);
 
+        std::vector<Vec2> positions(pucks.size());
+        std::vector<double> values(pucks.size());
+        for (size_t i = 0; i < pucks.size(); i++) { positions[i] = pucks[i].getComponent<CTransform>().p; }
+        grid.sample(positions.data(), positions.size(), transform, values.data());
+
+        double sum = 0;
+        for (double gridVal : values)
+        {
             double diff = 0;
             if (gridVal < t1) { diff = std::abs(gridVal - t1); } 
             else if (gridVal > t2) { diff = std::abs(gridVal - t2); }
@@ -49,4 +54,109 @@ namespace Eval
         double maxDiff = std::max(t1, 1-t2);
         return 1 - ((sum / world->getEntities("puck").size()) / maxDiff);
     }
+
+    // how far a grid value is outside [t1, t2], a puck's share of PuckAvgThresholdDiff
+    inline double ThresholdDiff(double gridVal, double t1, double t2)
+    {
+        if (gridVal < t1) { return std::abs(gridVal - t1); }
+        if (gridVal > t2) { return std::abs(gridVal - t2); }
+        return 0;
+    }
+
+    // Maintains PuckAvgThresholdDiff as the simulation runs
+    // Each puck's cell and share of the sum are remembered, and update() only
+    // looks at the entities the simulator reports as moved, and only samples
+    // the grid for those that changed cells, so the value can be read in O(1)
+    // after every step and costs nothing while the pucks are at rest. Shares
+    // are summed in fixed point, so the sum never drifts however many times
+    // they are swapped, and agrees with PuckAvgThresholdDiff to about 1e-12
+    class PuckThresholdTracker
+    {
+        static constexpr double FixedScale = 1099511627776.0;   // 2^40
+        static const size_t     NotPuck = (size_t)-1;
+
+        std::shared_ptr<World>  m_world;
+        GridTransform           m_transform;
+        double                  m_t1 = 0;
+        double                  m_t2 = 0;
+        std::vector<size_t>     m_slot;         // puck index of each entity id
+        std::vector<size_t>     m_cells;        // grid cell each puck is in
+        std::vector<int64_t>    m_shares;       // each puck's diff in fixed point
+        int64_t                 m_sum = 0;
+        size_t                  m_cellChanges = 0;
+
+        inline int64_t share(const Vec2 & pos) const
+        {
+            double diff = ThresholdDiff(m_world->getGrid().sample(pos, m_transform), m_t1, m_t2);
+            return (int64_t)std::llround(diff * FixedScale);
+        }
+
+    public:
+
+        PuckThresholdTracker() {}
+
+        PuckThresholdTracker(std::shared_ptr<World> world, double t1, double t2)
+            : m_world(world)
+            , m_t1(t1)
+            , m_t2(t2)
+        {
+            rebuild();
+        }
+
+        // recomputes every puck, needed if pucks are added or removed or the grid changes
+        void rebuild()
+        {
+            auto & grid = m_world->getGrid();
+            auto & pucks = m_world->getEntities("puck");
+            m_transform = GridTransform(grid.width(), grid.height(), m_world->width(), m_world->height(), GridTransform::Floor);
+
+            m_slot.assign(MaxEntities, (size_t)NotPuck);
+            m_cells.resize(pucks.size());
+            m_shares.resize(pucks.size());
+            m_sum = 0;
+            for (size_t i = 0; i < pucks.size(); i++)
+            {
+                const Vec2 & pos = pucks[i].getComponent<CTransform>().p;
+                m_slot[pucks[i].id()] = i;
+                m_cells[i]  = grid.width() ? m_transform.cellIndex(pos) : 0;
+                m_shares[i] = share(pos);
+                m_sum      += m_shares[i];
+            }
+        }
+
+        // applies the moves of the last simulator update
+        void update(const std::vector<Entity> & moved)
+        {
+            if (m_world->getGrid().width() == 0) { return; }
+
+            for (auto e : moved)
+            {
+                size_t i = m_slot[e.id()];
+                if (i == NotPuck) { continue; }
+
+                const Vec2 & pos = e.getComponent<CTransform>().p;
+                size_t cell = m_transform.cellIndex(pos);
+                if (cell == m_cells[i]) { continue; }
+
+                int64_t newShare = share(pos);
+                m_sum      += newShare - m_shares[i];
+                m_shares[i] = newShare;
+                m_cells[i]  = cell;
+                m_cellChanges++;
+            }
+        }
+
+        double value() const
+        {
+            if (m_shares.empty()) { return std::nan(""); }
+            double maxDiff = std::max(m_t1, 1 - m_t2);
+            return 1 - ((m_sum / FixedScale / m_shares.size()) / maxDiff);
+        }
+
+        // the number of times a puck changed cells, which is the work update() did
+        size_t numCellChanges() const
+        {
+            return m_cellChanges;
+        }
+    };
 }
\ No newline at end of file
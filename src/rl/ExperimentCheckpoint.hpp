@@ -0,0 +1,289 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include "CWaggle.h"
+#include "AtomicFile.hpp"
+#include "QLearning.hpp"
+
+// Header of an experiment checkpoint, which holds everything a run needs to
+// carry on exactly where it stopped: the world, the learner, every random
+// generator and the counters. The payload after the header is a sequence of
+// fields written by CheckpointWriter and read back in the same order by
+// CheckpointReader, in the byte order of the machine that wrote it
+// The checksum covers the payload, so a torn or truncated file is rejected
+struct ExperimentCheckpointHeader
+{
+    char     magic[8];      // "CWEXPCKP"
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t dataSize;      // bytes after the header
+    uint64_t checksum;      // 64-bit FNV-1a of those bytes
+
+    static const uint32_t CurrentVersion = 5;
+};
+
+// Appends fields to a checkpoint payload
+class CheckpointWriter
+{
+    std::vector<char> m_bytes;
+
+public:
+
+    CheckpointWriter()
+    {
+        m_bytes.resize(sizeof(ExperimentCheckpointHeader));
+    }
+
+    void writeBytes(const void * data, size_t size)
+    {
+        m_bytes.insert(m_bytes.end(), (const char *)data, (const char *)data + size);
+    }
+
+    // plain values only, anything with pointers must be written field by field
+    template <class T>
+    void write(const T & value)
+    {
+        writeBytes(&value, sizeof(T));
+    }
+
+    void writeString(const std::string & value)
+    {
+        write((uint64_t)value.size());
+        writeBytes(value.data(), value.size());
+    }
+
+    // sizes are always stored as 64 bits
+    void writeSizes(const std::vector<size_t> & values)
+    {
+        write((uint64_t)values.size());
+        for (size_t v : values) { write((uint64_t)v); }
+    }
+
+    // a vector of plain values
+    template <class T>
+    void writeArray(const std::vector<T> & values)
+    {
+        write((uint64_t)values.size());
+        writeBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    // a standard random engine, in the text form the standard guarantees round trips
+    template <class RNG>
+    void writeRNG(const RNG & rng)
+    {
+        std::stringstream ss;
+        ss << rng;
+        writeString(ss.str());
+    }
+
+    // the header followed by the payload, checksum included
+    std::vector<char> & finish()
+    {
+        ExperimentCheckpointHeader header = {};
+        memcpy(header.magic, "CWEXPCKP", 8);
+        header.version  = ExperimentCheckpointHeader::CurrentVersion;
+        header.dataSize = m_bytes.size() - sizeof(header);
+        header.checksum = QTableFileHeader::Checksum((const uint8_t *)m_bytes.data() + sizeof(header), (size_t)header.dataSize);
+        memcpy(m_bytes.data(), &header, sizeof(header));
+        return m_bytes;
+    }
+};
+
+// Reads the fields of a checkpoint payload
+// reading past the end returns zeros and clears good, so a reader can read a
+// whole section and check good once
+class CheckpointReader
+{
+    std::vector<char>   m_bytes;
+    size_t              m_pos = sizeof(ExperimentCheckpointHeader);
+    bool                m_good = false;
+
+public:
+
+    // loads and verifies a checkpoint, which is good only if the file is complete
+    CheckpointReader(const std::string & filename)
+    {
+        std::ifstream fin(filename, std::ios::binary);
+        m_bytes.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+        ExperimentCheckpointHeader header = {};
+        if (m_bytes.size() < sizeof(header)) { return; }
+        memcpy(&header, m_bytes.data(), sizeof(header));
+
+        m_good = memcmp(header.magic, "CWEXPCKP", 8) == 0
+              && header.version == ExperimentCheckpointHeader::CurrentVersion
+              && header.dataSize == m_bytes.size() - sizeof(header)
+              && header.checksum == QTableFileHeader::Checksum((const uint8_t *)m_bytes.data() + sizeof(header), (size_t)header.dataSize);
+    }
+
+    bool good() const
+    {
+        return m_good;
+    }
+
+    // returns a pointer to the next size bytes, or nullptr past the end
+    const uint8_t * readBytes(size_t size)
+    {
+        if (!m_good || size > m_bytes.size() - m_pos) { m_good = false; return nullptr; }
+        const uint8_t * data = (const uint8_t *)m_bytes.data() + m_pos;
+        m_pos += size;
+        return data;
+    }
+
+    template <class T>
+    T read()
+    {
+        T value = T();
+        const uint8_t * data = readBytes(sizeof(T));
+        if (data) { memcpy(&value, data, sizeof(T)); }
+        return value;
+    }
+
+    std::string readString()
+    {
+        uint64_t size = read<uint64_t>();
+        const uint8_t * data = readBytes((size_t)size);
+        return data ? std::string((const char *)data, (size_t)size) : std::string();
+    }
+
+    std::vector<size_t> readSizes()
+    {
+        uint64_t count = read<uint64_t>();
+        if (count > (m_bytes.size() - m_pos) / sizeof(uint64_t)) { m_good = false; return {}; }
+        std::vector<size_t> values((size_t)count);
+        for (auto & v : values) { v = (size_t)read<uint64_t>(); }
+        return values;
+    }
+
+    template <class T>
+    std::vector<T> readArray()
+    {
+        uint64_t count = read<uint64_t>();
+        if (count > (m_bytes.size() - m_pos) / sizeof(T)) { m_good = false; return {}; }
+        std::vector<T> values((size_t)count);
+        const uint8_t * data = readBytes(values.size() * sizeof(T));
+        if (data) { memcpy(values.data(), data, values.size() * sizeof(T)); }
+        return values;
+    }
+
+    template <class RNG>
+    void readRNG(RNG & rng)
+    {
+        std::stringstream ss(readString());
+        ss >> rng;
+        if (ss.fail()) { m_good = false; }
+    }
+};
+
+namespace ExperimentCheckpoint
+{
+    // writes under a temporary name and renames it over the previous
+    // checkpoint in one step, so a crash at any point leaves a complete one
+    bool Write(CheckpointWriter & writer, const std::string & filename)
+    {
+        const std::vector<char> & bytes = writer.finish();
+        return AtomicFile::Write(filename, bytes.data(), bytes.size(), "experiment checkpoint");
+    }
+
+    // the state of every entity that the simulation changes, in entity order,
+    // and the values of the world's fields. the entities themselves are not
+    // written, a world is restored into one built from the same config
+    void WriteWorld(CheckpointWriter & out, World & world)
+    {
+        auto & entities = world.getEntities();
+        out.write((uint64_t)world.getStep());
+        out.write((uint64_t)entities.size());
+        for (auto e : entities)
+        {
+            out.writeString(e.tag());
+
+            auto & t = e.getComponent<CTransform>();
+            out.write(t.p);
+            out.write(t.v);
+            out.write(t.a);
+            out.write((uint8_t)t.moved);
+            out.write((uint8_t)(e.hasComponent<CCircleBody>() && e.getComponent<CCircleBody>().collided));
+
+            bool steer = e.hasComponent<CSteer>();
+            out.write((uint8_t)steer);
+            if (steer)
+            {
+                out.write(e.getComponent<CSteer>().angle);
+                out.write(e.getComponent<CSteer>().speed);
+            }
+        }
+
+        out.write((uint64_t)world.getFields().size());
+        for (auto & kv : world.getFields())
+        {
+            out.writeString(kv.first);
+            auto & values = kv.second->values();
+            out.write((uint64_t)values.size());
+            out.writeBytes(values.data(), values.size() * sizeof(float));
+        }
+    }
+
+    // restores a world written by WriteWorld, returns false if the world it
+    // was written from had different entities or fields
+    bool ReadWorld(CheckpointReader & in, World & world)
+    {
+        auto & entities = world.getEntities();
+        size_t step = (size_t)in.read<uint64_t>();
+        if (in.read<uint64_t>() != entities.size()) { return false; }
+
+        for (auto e : entities)
+        {
+            if (in.readString() != e.tag() || !in.good()) { return false; }
+
+            auto & t = e.getComponent<CTransform>();
+            t.p     = in.read<Vec2>();
+            t.v     = in.read<Vec2>();
+            t.a     = in.read<Vec2>();
+            t.moved = in.read<uint8_t>() != 0;
+            bool collided = in.read<uint8_t>() != 0;
+            if (e.hasComponent<CCircleBody>()) { e.getComponent<CCircleBody>().collided = collided; }
+
+            if (in.read<uint8_t>())
+            {
+                if (!e.hasComponent<CSteer>()) { e.addComponent<CSteer>(); }
+                e.getComponent<CSteer>().angle = in.read<double>();
+                e.getComponent<CSteer>().speed = in.read<double>();
+            }
+
+            // sensors cache readings by step, which the restored world reuses
+            if (e.hasComponent<CSensorArray>())
+            {
+                auto & sensors = e.getComponent<CSensorArray>();
+                sensors.observationStep = (size_t)-1;
+                for (auto & s : sensors.gridSensors)     { s->invalidate(); }
+                for (auto & s : sensors.puckSensors)     { s->invalidate(); }
+                for (auto & s : sensors.obstacleSensors) { s->invalidate(); }
+                for (auto & s : sensors.rangeSensors)    { s->invalidate(); }
+                for (auto & s : sensors.fieldSensors)    { s->invalidate(); }
+            }
+        }
+
+        if (in.read<uint64_t>() != world.getFields().size()) { return false; }
+        for (size_t f = 0; f < world.getFields().size(); f++)
+        {
+            auto field = world.getField(in.readString());
+            uint64_t size = in.read<uint64_t>();
+            const uint8_t * data = in.readBytes((size_t)(size * sizeof(float)));
+            if (!field || !data || size != field->values().size()) { return false; }
+
+            std::vector<float> values((size_t)size);
+            memcpy(values.data(), data, values.size() * sizeof(float));
+            field->setValues(values);
+        }
+
+        world.setStep(step);
+        return in.good();
+    }
+}
@@ -1,96 +1,431 @@
 #pragma once
 
 #include <functional>
+#include <sstream>
+#include <array>
 
 #include "CWaggle.h"
 
-typedef std::function<size_t(const SensorReading &)> HashFunction;
+// hashes a robot's observation vector into a state index
+// kept for ad-hoc hashes written as lambdas, see FunctionHasher
+typedef std::function<size_t(const double *)> HashFunction;
+
+// Hashes observation vectors into state indices
+// A whole chunk of robots is hashed with one virtual call, so the per-robot
+// work inside hashBatch is inlined for the compiled encoders
+class StateHasher
+{
+public:
+
+    virtual ~StateHasher() {}
+
+    // the number of distinct states, every hash is below this
+    virtual size_t size() const = 0;
+
+    virtual size_t hash(const double * obs) const = 0;
+
+    virtual void hashBatch(const double * const * obs, size_t count, size_t * states) const = 0;
+};
+
+// creates a hasher for a given sensor layout, resolving feature names to
+// observation slots once so hashing itself never looks names up
+typedef std::function<std::shared_ptr<StateHasher>(const SensorLayout &)> HashFunctionBinder;
 
 struct HashFunctionData
 {
-    HashFunction Function;
+    HashFunctionBinder Bind;
     size_t MaxHashSize = 0;
 };
 
-namespace Hash
+// The fields a state hash is built from
+// Each field maps the observation to a value below its Size, and a hash is
+// the mixed radix number of its fields, the first field being the lowest
+// digit. Every value is clamped into range, so no hash can exceed its size
+namespace HashFields
 {
-    const HashFunctionData & GetHashData(const std::string & hashFunctionName);
+    // 1 when the feature is nonzero
+    struct NonZero
+    {
+        static const size_t Size = 2;
+        size_t feature;
+
+        NonZero(const SensorLayout & layout, const std::string & name)
+            : feature(SensorTools::RequireFeature(layout, name)) {}
+
+        inline size_t operator () (const double * obs) const
+        {
+            return obs[feature] != 0;
+        }
+    };
 
-    size_t OriginalHash(const SensorReading & reading)
+    // 1 when feature a is at least feature b
+    struct AtLeast
     {
-        const static std::string & name = "Original";
-        const static size_t maxHashSize = GetHashData(name).MaxHashSize;
+        static const size_t Size = 2;
+        size_t a, b;
 
-        const size_t MaxHashSize = (1 << 8);
-        size_t hash = 0;
+        AtLeast(const SensorLayout & layout, const std::string & nameA, const std::string & nameB)
+            : a(SensorTools::RequireFeature(layout, nameA)), b(SensorTools::RequireFeature(layout, nameB)) {}
 
-        hash += (reading.leftPucks == 0) ? 0 : (1 << 0);
-        hash += (reading.rightPucks == 0) ? 0 : (1 << 1);
-        hash += (reading.leftNest < reading.midNest) ? 0 : (1 << 2);
-        hash += (reading.rightNest < reading.midNest) ? 0 : (1 << 3);
+        inline size_t operator () (const double * obs) const
+        {
+            return !(obs[a] < obs[b]);
+        }
+    };
 
-        size_t midNestReading = (size_t)(floor(reading.midNest * 16));
-        if (midNestReading == 16) midNestReading = 15;
-        hash += midNestReading * (1 << 4);
+    // the feature, expected in [0, 1], split into N equal bins
+    inline size_t Bin(double value, size_t bins)
+    {
+        double x = value * bins;
+        return x >= bins ? bins - 1 : (x > 0 ? (size_t)x : 0);
+    }
 
-        if (hash >= maxHashSize) { std::cerr << "WARNING: " << name << " hash size too large: " << hash; }
-        return hash;
+    template <size_t N>
+    struct Bins
+    {
+        static const size_t Size = N;
+        size_t feature;
+
+        Bins(const SensorLayout & layout, const std::string & name)
+            : feature(SensorTools::RequireFeature(layout, name)) {}
+
+        inline size_t operator () (const double * obs) const
+        {
+            return Bin(obs[feature], N);
+        }
+    };
+
+    // the number of the N ascending thresholds the feature is at least
+    template <size_t N>
+    struct Thresholds
+    {
+        static const size_t Size = N + 1;
+        size_t feature;
+        std::array<double, N> thresholds;
+
+        Thresholds(const SensorLayout & layout, const std::string & name, const std::array<double, N> & t)
+            : feature(SensorTools::RequireFeature(layout, name)), thresholds(t) {}
+
+        inline size_t operator () (const double * obs) const
+        {
+            size_t count = 0;
+            for (size_t i = 0; i < N; i++) { count += obs[feature] >= thresholds[i]; }
+            return count;
+        }
+    };
+}
+
+// A hash composed at compile time from a list of fields, which the compiler
+// flattens into straight-line code with constant multipliers
+template <class... Fields>
+struct HashEncoder;
+
+template <>
+struct HashEncoder<>
+{
+    static const size_t Size = 1;
+
+    inline size_t operator () (const double *) const
+    {
+        return 0;
     }
+};
+
+template <class First, class... Rest>
+struct HashEncoder<First, Rest...>
+{
+    static const size_t Size = First::Size * HashEncoder<Rest...>::Size;
+
+    First                   first;
+    HashEncoder<Rest...>    rest;
 
-    size_t PuckMid4(const SensorReading & reading)
+    HashEncoder(const First & f, const Rest &... r)
+        : first(f), rest(r...) {}
+
+    inline size_t operator () (const double * obs) const
     {
-        const static std::string & name = "PuckMid4";
-        const static size_t maxHashSize = GetHashData(name).MaxHashSize;
-        size_t hash = 0;
+        return first(obs) + First::Size * rest(obs);
+    }
+};
 
-        hash += (reading.leftPucks == 0) ? 0 : (1 << 0);
-        hash += (reading.rightPucks == 0) ? 0 : (1 << 1);
+template <class Encoder>
+class EncodedHasher : public StateHasher
+{
+    Encoder m_encoder;
 
-        size_t midNestReading = (size_t)(floor(reading.midNest * 4));
-        if (midNestReading == 4) midNestReading = 3;
-        hash += midNestReading * (1 << 2);
+public:
 
-        if (hash >= maxHashSize) { std::cerr << "WARNING: " << name << " hash size too large: " << hash; }
-        return hash;
+    EncodedHasher(const Encoder & encoder)
+        : m_encoder(encoder) {}
+
+    size_t size() const override
+    {
+        return Encoder::Size;
     }
 
-    size_t PuckMid16(const SensorReading & reading)
+    size_t hash(const double * obs) const override
     {
-        const static std::string & name = "PuckMid16";
-        const static size_t maxHashSize = GetHashData(name).MaxHashSize;
-        size_t hash = 0;
+        return m_encoder(obs);
+    }
+
+    void hashBatch(const double * const * obs, size_t count, size_t * states) const override
+    {
+        for (size_t i = 0; i < count; i++) { states[i] = m_encoder(obs[i]); }
+    }
+};
+
+// One field of a hash declared in the config, one 'hashField' line each:
+//
+//   hashField nonzero   leftPucks              2 values
+//   hashField geq       leftNest midNest       2 values
+//   hashField bins      midNest 16             16 values
+//   hashField threshold midNest 0.25 0.5 0.75  one more value than thresholds
+struct HashFieldSpec
+{
+    std::string                 kind;
+    std::vector<std::string>    features;
+    size_t                      bins = 0;
+    std::vector<double>         thresholds;
+
+    size_t size() const
+    {
+        if (kind == "bins")      { return bins; }
+        if (kind == "threshold") { return thresholds.size() + 1; }
+        return 2;
+    }
+
+    // parses the rest of a hashField line
+    static HashFieldSpec Parse(const std::string & line)
+    {
+        std::stringstream ss(line);
+        HashFieldSpec field;
+        ss >> field.kind;
+
+        std::string feature;
+        bool valid = true;
+        if (field.kind == "nonzero")
+        {
+            valid = (bool)(ss >> feature);
+            field.features = { feature };
+        }
+        else if (field.kind == "geq")
+        {
+            std::string other;
+            valid = (bool)(ss >> feature >> other);
+            field.features = { feature, other };
+        }
+        else if (field.kind == "bins")
+        {
+            valid = (bool)(ss >> feature >> field.bins) && field.bins > 0;
+            field.features = { feature };
+        }
+        else if (field.kind == "threshold")
+        {
+            valid = (bool)(ss >> feature);
+            field.features = { feature };
+            double t;
+            while (ss >> t) { field.thresholds.push_back(t); }
+            valid = valid && !field.thresholds.empty() && std::is_sorted(field.thresholds.begin(), field.thresholds.end());
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            std::cerr << "Invalid hashField, expected nonzero f | geq a b | bins f n | threshold f t1 t2 ...: " << line << "\n";
+            exit(-1);
+        }
+        return field;
+    }
+};
+
+typedef std::vector<HashFieldSpec> HashSpec;
 
-        hash += (reading.leftPucks == 0) ? 0 : (1 << 0);
-        hash += (reading.rightPucks == 0) ? 0 : (1 << 1);
+// the number of states of a spec
+inline size_t HashSpecSize(const HashSpec & spec)
+{
+    size_t size = 1;
+    for (auto & field : spec)
+    {
+        if (field.size() > std::numeric_limits<size_t>::max() / size / 2)
+        {
+            std::cerr << "Hash spec has too many states to index\n";
+            exit(-1);
+        }
+        size *= field.size();
+    }
+    return size;
+}
+
+// Hashes with fields chosen at run time, for specs from the config
+// Fields are grouped by kind and each kind is evaluated in its own loop, so
+// there is no per-field dispatch, only the loops over each kind's fields
+class DynamicHasher : public StateHasher
+{
+    struct Term
+    {
+        size_t a = 0, b = 0;    // features
+        size_t multiplier = 0;
+        size_t bins = 0;
+        std::vector<double> thresholds;
+    };
 
-        size_t midNestReading = (size_t)(floor(reading.midNest * 16));
-        if (midNestReading == 16) midNestReading = 15;
-        hash += midNestReading * (1 << 2);
+    std::vector<Term>   m_nonZero;
+    std::vector<Term>   m_atLeast;
+    std::vector<Term>   m_bins;
+    std::vector<Term>   m_thresholds;
+    size_t              m_size = 1;
 
-        if (hash >= maxHashSize) { std::cerr << "WARNING: " << name << " hash size too large: " << hash; }
+public:
+
+    DynamicHasher(const HashSpec & spec, const SensorLayout & layout)
+        : m_size(HashSpecSize(spec))
+    {
+        size_t multiplier = 1;
+        for (auto & field : spec)
+        {
+            Term term;
+            term.a          = SensorTools::RequireFeature(layout, field.features[0]);
+            term.b          = field.features.size() > 1 ? SensorTools::RequireFeature(layout, field.features[1]) : 0;
+            term.multiplier = multiplier;
+            term.bins       = field.bins;
+            term.thresholds = field.thresholds;
+            multiplier     *= field.size();
+
+            if (field.kind == "nonzero")    { m_nonZero.push_back(term); }
+            else if (field.kind == "geq")   { m_atLeast.push_back(term); }
+            else if (field.kind == "bins")  { m_bins.push_back(term); }
+            else                            { m_thresholds.push_back(term); }
+        }
+    }
+
+    size_t size() const override
+    {
+        return m_size;
+    }
+
+    size_t hash(const double * obs) const override
+    {
+        size_t hash = 0;
+        for (auto & t : m_nonZero) { hash += (obs[t.a] != 0) * t.multiplier; }
+        for (auto & t : m_atLeast) { hash += !(obs[t.a] < obs[t.b]) * t.multiplier; }
+        for (auto & t : m_bins)    { hash += HashFields::Bin(obs[t.a], t.bins) * t.multiplier; }
+        for (auto & t : m_thresholds)
+        {
+            size_t count = 0;
+            for (double threshold : t.thresholds) { count += obs[t.a] >= threshold; }
+            hash += count * t.multiplier;
+        }
         return hash;
     }
 
-    const HashFunctionData & GetHashData(const std::string & hashFunctionName)
+    void hashBatch(const double * const * obs, size_t count, size_t * states) const override
+    {
+        for (size_t i = 0; i < count; i++) { states[i] = hash(obs[i]); }
+    }
+};
+
+// Wraps a hash written as a function, for quick experiments
+// the function is trusted to stay below size
+class FunctionHasher : public StateHasher
+{
+    HashFunction    m_function;
+    size_t          m_size;
+
+public:
+
+    FunctionHasher(HashFunction function, size_t size)
+        : m_function(function), m_size(size) {}
+
+    size_t size() const override
+    {
+        return m_size;
+    }
+
+    size_t hash(const double * obs) const override
     {
-        static std::map<std::string, HashFunctionData> hashData;
+        return m_function(obs);
+    }
+
+    void hashBatch(const double * const * obs, size_t count, size_t * states) const override
+    {
+        for (size_t i = 0; i < count; i++) { states[i] = m_function(obs[i]); }
+    }
+};
+
+namespace Hash
+{
+    using namespace HashFields;
+
+    typedef HashEncoder<NonZero, NonZero, AtLeast, AtLeast, Bins<16>>   OriginalEncoder;
+    typedef HashEncoder<NonZero, NonZero, Bins<4>>                      PuckMid4Encoder;
+    typedef HashEncoder<NonZero, NonZero, Bins<16>>                     PuckMid16Encoder;
 
+    template <class Encoder>
+    std::shared_ptr<StateHasher> MakeHasher(const Encoder & encoder)
+    {
+        return std::make_shared<EncodedHasher<Encoder>>(encoder);
+    }
+
+    std::shared_ptr<StateHasher> OriginalHash(const SensorLayout & layout)
+    {
+        return MakeHasher(OriginalEncoder
+        (
+            NonZero(layout, "leftPucks"),
+            NonZero(layout, "rightPucks"),
+            AtLeast(layout, "leftNest", "midNest"),
+            AtLeast(layout, "rightNest", "midNest"),
+            Bins<16>(layout, "midNest")
+        ));
+    }
+
+    std::shared_ptr<StateHasher> PuckMid4(const SensorLayout & layout)
+    {
+        return MakeHasher(PuckMid4Encoder
+        (
+            NonZero(layout, "leftPucks"),
+            NonZero(layout, "rightPucks"),
+            Bins<4>(layout, "midNest")
+        ));
+    }
+
+    std::shared_ptr<StateHasher> PuckMid16(const SensorLayout & layout)
+    {
+        return MakeHasher(PuckMid16Encoder
+        (
+            NonZero(layout, "leftPucks"),
+            NonZero(layout, "rightPucks"),
+            Bins<16>(layout, "midNest")
+        ));
+    }
+
+    const HashFunctionData & GetHashData(const std::string & hashFunctionName)
+    {
         // set up the hash function data the first time we call this function
-        // it will only be called once per experiment
-        if (hashData.empty())
+        // static initialization is thread safe, so hogwild worlds can bind concurrently
+        static const std::map<std::string, HashFunctionData> hashData =
         {
-            hashData["Original"]    = { OriginalHash,   (1 << 8) };
-            hashData["PuckMid4"]    = { PuckMid4,       (1 << 4) };
-            hashData["PuckMid16"]   = { PuckMid16,      (1 << 6) };
-        }
+            { "Original",   { OriginalHash,   OriginalEncoder::Size } },
+            { "PuckMid4",   { PuckMid4,       PuckMid4Encoder::Size } },
+            { "PuckMid16",  { PuckMid16,      PuckMid16Encoder::Size } },
+        };
 
-        if (hashData.find(hashFunctionName) == hashData.end())
+        auto it = hashData.find(hashFunctionName);
+        if (it == hashData.end())
         {
             std::cerr << "Warning: Hash Function Not Found: " << hashFunctionName << "\n";
             exit(-1);
         }
 
-        return hashData[hashFunctionName];
+        return it->second;
     }
 
-}
\ No newline at end of file
+    // the hasher for a config, its hashField lines if it has any, otherwise the named hash
+    std::shared_ptr<StateHasher> Bind(const std::string & hashFunctionName, const HashSpec & spec, const SensorLayout & layout)
+    {
+        if (!spec.empty()) { return std::make_shared<DynamicHasher>(spec, layout); }
+        return GetHashData(hashFunctionName).Bind(layout);
+    }
+}
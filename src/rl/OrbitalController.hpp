@@ -9,14 +9,32 @@ struct OrbitalConstructionConfig
     double thresholds[2] = { 0.7, 0.8 };
 };
 
+// observation slots of the features used by the orbital construction controller
+struct OrbitalConstructionFeatures
+{
+    size_t leftNest, midNest, rightNest, leftPucks, rightPucks, leftObstacle;
+
+    OrbitalConstructionFeatures() {}
+    OrbitalConstructionFeatures(const SensorLayout & layout)
+        : leftNest      (SensorTools::RequireFeature(layout, "leftNest"))
+        , midNest       (SensorTools::RequireFeature(layout, "midNest"))
+        , rightNest     (SensorTools::RequireFeature(layout, "rightNest"))
+        , leftPucks     (SensorTools::RequireFeature(layout, "leftPucks"))
+        , rightPucks    (SensorTools::RequireFeature(layout, "rightPucks"))
+        , leftObstacle  (SensorTools::RequireFeature(layout, "leftObstacle"))
+    {
+    }
+};
+
 namespace EntityControllers
 {
     EntityAction OrbitalConstruction(Entity e, 
                                      std::shared_ptr<World> world, 
-                                     const SensorReading & reading,
+                                     const double * obs,
+                                     const OrbitalConstructionFeatures & f,
                                      const OrbitalConstructionConfig & config)
     {
-        if (reading.leftObstacle > 0)
+        if (obs[f.leftObstacle] > 0)
         {
             return EntityAction(config.forwardSpeed, config.maxAngularSpeed);
         }
@@ -24,7 +42,7 @@ namespace EntityControllers
         size_t type = e.getComponent<CRobotType>().type;
         bool innie = type == 1;
 
-        if (reading.rightNest >= reading.midNest && reading.midNest >= reading.leftNest)
+        if (obs[f.rightNest] >= obs[f.midNest] && obs[f.midNest] >= obs[f.leftNest])
         {
             // The gradient is in the desired orientation with the highest
             // sensed value to the right, then the centre value in the middle,
@@ -32,17 +50,17 @@ namespace EntityControllers
 
             // These conditions steer in (for an innie) and out (for an outie)
             // to nudge a puck inwards or outwards.
-            if (innie && reading.rightPucks > 0)
+            if (innie && obs[f.rightPucks] > 0)
             {
                 return EntityAction(config.forwardSpeed, config.maxAngularSpeed);
             }
-            else if (!innie && reading.leftPucks > 0)
+            else if (!innie && obs[f.leftPucks] > 0)
             {
                 return EntityAction(config.forwardSpeed, -config.maxAngularSpeed);
             }
 
             // We now act to maintain the centre value at the desired isoline.
-            if (reading.midNest < config.thresholds[type])
+            if (obs[f.midNest] < config.thresholds[type])
             {
                 return EntityAction(config.forwardSpeed, 0.3 * config.maxAngularSpeed);
             }
@@ -51,7 +69,7 @@ namespace EntityControllers
                 return EntityAction(config.forwardSpeed, -0.3 * config.maxAngularSpeed);
             }
         }
-        else if (reading.midNest >= reading.rightNest && reading.midNest >= reading.leftNest)
+        else if (obs[f.midNest] >= obs[f.rightNest] && obs[f.midNest] >= obs[f.leftNest])
         {
             // We are heading uphill of the gradient, turn left to return to a
             // clockwise orbit.
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include "CWaggle.h"
+#include "QLearning.hpp"
+#include "TileCoding.hpp"
+#include "Hash.hpp"
+
+// The greedy policy of a trained learner, run without exploring or learning
+// For a table the actions tied for the best value of every row are found
+// once up front, so choosing an action is one lookup rather than a scan of
+// the row, and a row with a single best action needs no random draw. Tile
+// coded values are summed per state as they are in training. Nothing is
+// written after bind, so one policy serves every evaluation thread
+class GreedyPolicy
+{
+    std::shared_ptr<QLearning>      m_table;
+    std::shared_ptr<TileCodedQ>     m_tiles;
+    std::shared_ptr<StateHasher>    m_hasher;
+    std::vector<uint64_t>           m_ties;     // the best actions of each table row, empty above 64 actions
+
+public:
+
+    GreedyPolicy(std::shared_ptr<QLearning> table)
+        : m_table(table)
+    {
+        if (!m_table->hasGreedyMasks()) { return; }
+
+        m_ties.resize(m_table->numRows());
+        for (size_t row = 0; row < m_ties.size(); row++) { m_ties[row] = m_table->greedyMask(row); }
+    }
+
+    GreedyPolicy(std::shared_ptr<TileCodedQ> tiles)
+        : m_tiles(tiles)
+    {
+    }
+
+    // resolves the observation features, which every robot evaluated must share
+    void bind(const SensorLayout & layout, const std::string & hashFunction, const HashSpec & hashSpec)
+    {
+        if (m_tiles) { m_tiles->bind(layout); }
+        else         { m_hasher = Hash::Bind(hashFunction, hashSpec, layout); }
+    }
+
+    // the greedy action for each of count observations, with ties broken by rng
+    // active is the caller's scratch space for the tile coder's rows
+    template <class RNG>
+    void selectBatch(const double * const * obs, size_t count, size_t * actions, std::vector<uint32_t> & active, RNG & rng) const
+    {
+        if (m_tiles)
+        {
+            size_t numActive = m_tiles->activeCount();
+            active.resize(count * numActive);
+            m_tiles->encodeBatch(obs, count, active.data());
+            for (size_t i = 0; i < count; i++) { actions[i] = m_tiles->selectActionFromPolicy(&active[i * numActive], rng); }
+            return;
+        }
+
+        // the states are hashed into actions, then each is replaced by its action
+        m_hasher->hashBatch(obs, count, actions);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (m_ties.empty())
+            {
+                actions[i] = m_table->selectActionFromPolicy(actions[i], rng);
+                continue;
+            }
+
+            uint64_t ties = m_ties[m_table->rowOf(actions[i])];
+            if (ties & (ties - 1))
+            {
+                size_t choice = rng() % QRow::CountBits(ties);
+                while (choice--) { ties &= ties - 1; }
+            }
+            actions[i] = QRow::LowestBit(ties);
+        }
+    }
+};
+
+// One evaluation episode, which ends when the pucks form or at its step limit
+struct EvalEpisode
+{
+    size_t seed         = 0;
+    size_t steps        = 0;
+    bool   formed       = false;
+    double finalEval    = 0;
+    size_t decisions    = 0;    // robot actions chosen, fewer than steps * robots when controlSkip > 1
+};
+
+// Statistics over a set of evaluation episodes
+// formation times are over the episodes that formed, and are 0 if none did
+struct PolicyEvalSummary
+{
+    size_t episodes             = 0;
+    size_t formations           = 0;
+    double formationRate        = 0;
+    double formationMean        = 0;
+    double formationStdDev      = 0;
+    double formationMedian      = 0;
+    double formationP90         = 0;
+    double formationMin         = 0;
+    double formationMax         = 0;
+    double meanFinalEval        = 0;
+    size_t steps                = 0;
+    size_t decisions            = 0;
+    double stepsPerSecond       = 0;
+    double decisionsPerSecond   = 0;    // robot actions chosen per second
+
+    static PolicyEvalSummary Compute(const std::vector<EvalEpisode> & episodes, double seconds)
+    {
+        PolicyEvalSummary summary;
+        std::vector<double> times;
+        for (auto & episode : episodes)
+        {
+            summary.steps         += episode.steps;
+            summary.decisions     += episode.decisions;
+            summary.meanFinalEval += episode.finalEval / episodes.size();
+            if (episode.formed) { times.push_back((double)episode.steps); }
+        }
+
+        summary.episodes            = episodes.size();
+        summary.formations          = times.size();
+        summary.formationRate       = episodes.empty() ? 0 : (double)times.size() / episodes.size();
+        summary.stepsPerSecond      = seconds > 0 ? summary.steps / seconds : 0;
+        summary.decisionsPerSecond  = seconds > 0 ? summary.decisions / seconds : 0;
+        if (times.empty()) { return summary; }
+
+        // percentiles are nearest rank
+        std::sort(times.begin(), times.end());
+        auto percentile = [&](size_t percent) { return times[std::max<size_t>((percent * times.size() + 99) / 100, 1) - 1]; };
+
+        double sum = 0, squares = 0;
+        for (double t : times) { sum += t; squares += t * t; }
+        summary.formationMean   = sum / times.size();
+        summary.formationStdDev = std::sqrt(std::max(0.0, squares / times.size() - summary.formationMean * summary.formationMean));
+        summary.formationMedian = percentile(50);
+        summary.formationP90    = percentile(90);
+        summary.formationMin    = times.front();
+        summary.formationMax    = times.back();
+        return summary;
+    }
+
+    // one 'key value' line per result, like RLRunSummary, so cwaggle_sweep can rank policies
+    void write(const std::string & filename) const
+    {
+        std::ofstream fout(filename);
+        fout << "episodes "            << episodes << "\n";
+        fout << "formations "          << formations << "\n";
+        fout << "formationRate "       << formationRate << "\n";
+        fout << "formationMean "       << formationMean << "\n";
+        fout << "formationStdDev "     << formationStdDev << "\n";
+        fout << "formationMedian "     << formationMedian << "\n";
+        fout << "formationP90 "        << formationP90 << "\n";
+        fout << "formationMin "        << formationMin << "\n";
+        fout << "formationMax "        << formationMax << "\n";
+        fout << "meanFinalEval "       << meanFinalEval << "\n";
+        fout << "steps "               << steps << "\n";
+        fout << "decisions "           << decisions << "\n";
+        fout << "stepsPerSecond "      << stepsPerSecond << "\n";
+        fout << "decisionsPerSecond "  << decisionsPerSecond << "\n";
+    }
+};
@@ -3,135 +3,1331 @@
 #include <vector>
 #include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <bitset>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
-class QLearning 
+#include "AlignedAllocator.hpp"
+#include "AtomicFile.hpp"
+#include "MappedFile.hpp"
+#include "BackgroundWorker.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define CWAGGLE_QTABLE_SSE
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Kernels that scan one row of a Q table
+// Rows are padded to a whole number of SIMD vectors with the lowest value of
+// the type, so padding never wins a max, and masks have bit a set for action a
+// Masks only cover the first 64 actions, larger tables use the scalar path
+namespace QRow
+{
+    template <class T> struct Lanes { static const size_t Count = 1; };
+
+    template <class T>
+    inline T Max(const T * row, size_t stride)
+    {
+        return *std::max_element(row, row + stride);
+    }
+
+    // actions whose value equals v exactly
+    template <class T>
+    inline uint64_t EqualMask(const T * row, size_t stride, T v)
+    {
+        uint64_t mask = 0;
+        for (size_t a = 0; a < stride; a++) { mask |= (uint64_t)(row[a] == v) << a; }
+        return mask;
+    }
+
+    // actions whose value is less than thresh below v, i.e. fabs(q - v) < thresh when v is the max
+    template <class T>
+    inline uint64_t WithinMask(const T * row, size_t stride, T v, T thresh)
+    {
+        uint64_t mask = 0;
+        for (size_t a = 0; a < stride; a++) { mask |= (uint64_t)(v - row[a] < thresh) << a; }
+        return mask;
+    }
+
+#ifdef CWAGGLE_QTABLE_SSE
+    template <> struct Lanes<double> { static const size_t Count = 2; };
+    template <> struct Lanes<float>  { static const size_t Count = 4; };
+
+    template <>
+    inline double Max<double>(const double * row, size_t stride)
+    {
+        __m128d m = _mm_load_pd(row);
+        for (size_t a = 2; a < stride; a += 2) { m = _mm_max_pd(m, _mm_load_pd(row + a)); }
+        m = _mm_max_pd(m, _mm_unpackhi_pd(m, m));
+        return _mm_cvtsd_f64(m);
+    }
+
+    template <>
+    inline float Max<float>(const float * row, size_t stride)
+    {
+        __m128 m = _mm_load_ps(row);
+        for (size_t a = 4; a < stride; a += 4) { m = _mm_max_ps(m, _mm_load_ps(row + a)); }
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+
+    template <>
+    inline uint64_t EqualMask<double>(const double * row, size_t stride, double v)
+    {
+        const __m128d vv = _mm_set1_pd(v);
+        uint64_t mask = 0;
+        for (size_t a = 0; a < stride; a += 2)
+        {
+            mask |= (uint64_t)_mm_movemask_pd(_mm_cmpeq_pd(_mm_load_pd(row + a), vv)) << a;
+        }
+        return mask;
+    }
+
+    template <>
+    inline uint64_t EqualMask<float>(const float * row, size_t stride, float v)
+    {
+        const __m128 vv = _mm_set1_ps(v);
+        uint64_t mask = 0;
+        for (size_t a = 0; a < stride; a += 4)
+        {
+            mask |= (uint64_t)_mm_movemask_ps(_mm_cmpeq_ps(_mm_load_ps(row + a), vv)) << a;
+        }
+        return mask;
+    }
+
+    template <>
+    inline uint64_t WithinMask<double>(const double * row, size_t stride, double v, double thresh)
+    {
+        const __m128d vv = _mm_set1_pd(v);
+        const __m128d vt = _mm_set1_pd(thresh);
+        uint64_t mask = 0;
+        for (size_t a = 0; a < stride; a += 2)
+        {
+            mask |= (uint64_t)_mm_movemask_pd(_mm_cmplt_pd(_mm_sub_pd(vv, _mm_load_pd(row + a)), vt)) << a;
+        }
+        return mask;
+    }
+
+    template <>
+    inline uint64_t WithinMask<float>(const float * row, size_t stride, float v, float thresh)
+    {
+        const __m128 vv = _mm_set1_ps(v);
+        const __m128 vt = _mm_set1_ps(thresh);
+        uint64_t mask = 0;
+        for (size_t a = 0; a < stride; a += 4)
+        {
+            mask |= (uint64_t)_mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(vv, _mm_load_ps(row + a)), vt)) << a;
+        }
+        return mask;
+    }
+#endif
+
+    // max of the row and the mask of actions tied for it, in one call
+    template <class T>
+    inline T MaxTies(const T * row, size_t stride, uint64_t & ties)
+    {
+        T maxVal = Max(row, stride);
+        ties = EqualMask(row, stride, maxVal);
+        return maxVal;
+    }
+
+    inline size_t CountBits(uint64_t mask)
+    {
+        return std::bitset<64>(mask).count();
+    }
+
+    // index of the lowest set bit, mask must not be 0
+    inline size_t LowestBit(uint64_t mask)
+    {
+        #if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            _BitScanForward64(&index, mask);
+            return index;
+        #elif defined(__GNUC__)
+            return (size_t)__builtin_ctzll(mask);
+        #else
+            size_t index = 0;
+            while (!(mask & 1)) { mask >>= 1; index++; }
+            return index;
+        #endif
+    }
+}
+
+// Atomic access to the plain cells of a table
+// Tables are ordinary arrays, scanned with plain and SIMD loads, but in the
+// hogwild modes many threads, and with a shared file many processes, update
+// them in place. The cells are never treated as std::atomic objects, which
+// they are not; these apply the compiler's atomic operations to them directly
+// Only the loads and stores made through here are atomic, the row scans stay
+// plain loads that may race with them, which tabular Q-learning tolerates
+namespace CellAtomic
+{
+    template <class T>
+    inline void Check()
+    {
+        static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "atomic cells must be 1, 2, 4 or 8 bytes");
+        static_assert(alignof(T) >= sizeof(T), "atomic cells must be aligned to their size");
+        #if defined(__GNUC__) || defined(__clang__)
+            static_assert(__atomic_always_lock_free(sizeof(T), 0), "atomic cells must be lock-free");
+        #endif
+    }
+
+    #if defined(__GNUC__) || defined(__clang__)
+
+        template <class T>
+        inline T Load(const T & cell)
+        {
+            Check<T>();
+            T value;
+            __atomic_load(&cell, &value, __ATOMIC_RELAXED);
+            return value;
+        }
+
+        template <class T>
+        inline void Store(T & cell, T value)
+        {
+            Check<T>();
+            __atomic_store(&cell, &value, __ATOMIC_RELAXED);
+        }
+
+        // stores desired if the cell holds expected, otherwise loads the cell into expected
+        template <class T>
+        inline bool CompareExchange(T & cell, T & expected, T desired)
+        {
+            Check<T>();
+            return __atomic_compare_exchange(&cell, &expected, &desired, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+
+        // integer cells only, returns the value before the add
+        template <class T>
+        inline T FetchAdd(T & cell, T value)
+        {
+            Check<T>();
+            return __atomic_fetch_add(&cell, value, __ATOMIC_RELAXED);
+        }
+
+    #elif defined(_MSC_VER)
+
+        // aligned volatile accesses of up to 8 bytes are single instructions
+        template <size_t Size> struct Ops;
+
+        template <> struct Ops<1>
+        {
+            typedef char Int;
+            static Int  Load(const volatile Int * p)                  { return __iso_volatile_load8((const volatile __int8 *)p); }
+            static void Store(volatile Int * p, Int v)                { __iso_volatile_store8((volatile __int8 *)p, v); }
+            static Int  CompareExchange(volatile Int * p, Int v, Int e) { return _InterlockedCompareExchange8(p, v, e); }
+            static Int  Add(volatile Int * p, Int v)                  { return _InterlockedExchangeAdd8(p, v); }
+        };
+
+        template <> struct Ops<2>
+        {
+            typedef short Int;
+            static Int  Load(const volatile Int * p)                  { return __iso_volatile_load16((const volatile __int16 *)p); }
+            static void Store(volatile Int * p, Int v)                { __iso_volatile_store16((volatile __int16 *)p, v); }
+            static Int  CompareExchange(volatile Int * p, Int v, Int e) { return _InterlockedCompareExchange16(p, v, e); }
+            static Int  Add(volatile Int * p, Int v)                  { return _InterlockedExchangeAdd16(p, v); }
+        };
+
+        template <> struct Ops<4>
+        {
+            typedef long Int;
+            static Int  Load(const volatile Int * p)                  { return __iso_volatile_load32((const volatile __int32 *)p); }
+            static void Store(volatile Int * p, Int v)                { __iso_volatile_store32((volatile __int32 *)p, v); }
+            static Int  CompareExchange(volatile Int * p, Int v, Int e) { return _InterlockedCompareExchange(p, v, e); }
+            static Int  Add(volatile Int * p, Int v)                  { return _InterlockedExchangeAdd(p, v); }
+        };
+
+        template <> struct Ops<8>
+        {
+            typedef __int64 Int;
+            static Int  Load(const volatile Int * p)                  { return __iso_volatile_load64(p); }
+            static void Store(volatile Int * p, Int v)                { __iso_volatile_store64(p, v); }
+            static Int  CompareExchange(volatile Int * p, Int v, Int e) { return _InterlockedCompareExchange64(p, v, e); }
+            static Int  Add(volatile Int * p, Int v)                  { return _InterlockedExchangeAdd64(p, v); }
+        };
+
+        template <class T>
+        inline volatile typename Ops<sizeof(T)>::Int * Cell(const T & cell)
+        {
+            Check<T>();
+            return (volatile typename Ops<sizeof(T)>::Int *)const_cast<T *>(&cell);
+        }
+
+        template <class T>
+        inline typename Ops<sizeof(T)>::Int ToInt(T value)
+        {
+            typename Ops<sizeof(T)>::Int i;
+            memcpy(&i, &value, sizeof(T));
+            return i;
+        }
+
+        template <class T>
+        inline T FromInt(typename Ops<sizeof(T)>::Int i)
+        {
+            T value;
+            memcpy(&value, &i, sizeof(T));
+            return value;
+        }
+
+        template <class T>
+        inline T Load(const T & cell)
+        {
+            return FromInt<T>(Ops<sizeof(T)>::Load(Cell(cell)));
+        }
+
+        template <class T>
+        inline void Store(T & cell, T value)
+        {
+            Ops<sizeof(T)>::Store(Cell(cell), ToInt(value));
+        }
+
+        template <class T>
+        inline bool CompareExchange(T & cell, T & expected, T desired)
+        {
+            typename Ops<sizeof(T)>::Int old = Ops<sizeof(T)>::CompareExchange(Cell(cell), ToInt(desired), ToInt(expected));
+            if (old == ToInt(expected)) { return true; }
+            expected = FromInt<T>(old);
+            return false;
+        }
+
+        template <class T>
+        inline T FetchAdd(T & cell, T value)
+        {
+            return (T)Ops<sizeof(T)>::Add(Cell(cell), (typename Ops<sizeof(T)>::Int)value);
+        }
+
+    #endif
+}
+
+// Header of the binary Q table checkpoint format
+// The Q, P and N blocks follow at their offsets as raw row-major arrays, in the
+// byte order of the machine that wrote the file. Q and P rows are stride values
+// long (the padded rows of the table) and N rows are numActions counters
+// The checksum covers every byte after the header, so torn or truncated files
+// are rejected instead of silently loading a partial table
+struct QTableFileHeader
+{
+    char     magic[8];      // "CWQTABLE"
+    uint32_t version;
+    uint32_t valueBytes;    // 4 for float, 8 for double
+    uint32_t countBytes;    // 1, 2, 4 or 8
+    uint32_t flags;         // see Flags
+    uint64_t numStates;
+    uint64_t numActions;
+    uint64_t stride;
+    uint64_t updates;
+    uint64_t visited;
+    double   alpha;
+    double   gamma;
+    double   initialQ;
+    uint64_t qOffset;       // byte offsets of the blocks from the start of the file
+    uint64_t pOffset;
+    uint64_t nOffset;
+    uint64_t dataSize;      // bytes after the header
+    uint64_t checksum;      // 64-bit FNV-1a of those bytes
+
+    // a live file is a table that processes are updating in place (see
+    // QLearningTable::attachShared), its checksum is not kept up to date and
+    // its updates and visited counts are only advanced by merges
+    // a sparse table's numStates counts its rows, and a key block follows
+    // the N block, see QLearningTable::KeysOffset
+    enum Flags { Live = 1, Sparse = 2 };
+
+    static const uint32_t CurrentVersion = 1;
+    static const uint64_t BlockAlignment = 64;
+
+    static bool HasMagic(const char * bytes)
+    {
+        return memcmp(bytes, "CWQTABLE", 8) == 0;
+    }
+
+    static uint64_t Checksum(const uint8_t * data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+// Live state of a table file shared between processes, stored directly after
+// the header of a live file. Every field is only accessed atomically
+struct QTableSharedBlock
+{
+    uint64_t state;         // always 2, ready, as files are created whole. 0 and 1 were a file being initialized in place
+    uint64_t attaches;      // processes that have ever attached
+    uint64_t detaches;      // processes that detached cleanly, so attaches - detaches are running or crashed
+    uint64_t merges;        // number of times a process merged its counters into the header
+    uint64_t reserved[4];
+
+    enum State { New = 0, Initializing = 1, Ready = 2 };
+};
+
+// Statistics of a table file shared between processes
+struct QTableSharedStats
+{
+    size_t attaches = 0;
+    size_t detaches = 0;
+    size_t merges   = 0;
+    size_t updates  = 0;
+    size_t visited  = 0;
+};
+
+// Occupancy of a sparse table (see QLearningTable), counted when asked for
+struct QTableSparseStats
+{
+    size_t slots     = 0;   // rows that states can be stored in
+    size_t used      = 0;   // rows holding a state
+    size_t drops     = 0;   // updates discarded because their state found no free row
+    size_t maxProbe  = 0;   // longest distance of a stored state from its home slot
+    double meanProbe = 0;
+};
+
+// Update counters kept by one thread while it shares a table with others
+// (see QLearningTable::updateValueShared), merged into the table afterwards
+// It also holds the thread's scratch space for the shared updates, so they
+// allocate nothing once it has grown to the largest batch
+struct QLearningStats
+{
+    size_t updates = 0;
+    size_t visited = 0;     // state-action pairs this thread was the first to visit
+
+    std::vector<size_t> batchStates;    // distinct states of the last batch
+    std::vector<char>   isMax;          // the max actions of a row, above 64 actions
+
+    // zeroes the counters once they are merged, keeping the scratch space
+    void resetCounts()
+    {
+        updates = 0;
+        visited = 0;
+    }
+};
+
+// Tabular Q-learning
+// Each of Q, P and N is one contiguous table with a row per state. Q and P rows
+// are padded to a whole number of SIMD vectors and aligned, so finding the max
+// action and its ties is a couple of vector passes over one or two cache lines
+// Value is the type of Q and P (float halves the table), and Count is the visit
+// counter type, which saturates rather than wrapping
+// A sparse table stores only the states that have been updated, in a fixed
+// number of rows found by open addressing on the state, so large state spaces
+// cost memory only for the states actually visited. Each slot of the hash is
+// one row of the tables, a state claims a slot with a compare-and-swap on its
+// key, which keeps the shared updates lock-free. One extra row at the end is
+// never written and stands in for every state without a row, so reading an
+// unvisited state sees initial values. Updates to a state that finds no free
+// slot within MaxProbes are dropped and counted
+template <class Value = double, class Count = uint32_t>
+class QLearningTable
 {
     size_t m_numStates  = 0;
     size_t m_numActions = 0;
+    size_t m_numRows    = 0;    // rows of Q, P and N, equal to m_numStates unless sparse
+    size_t m_stride     = 0;    // values per padded Q or P row
     size_t m_updates    = 0;
     size_t m_visited    = 0;
     double m_alpha      = 0;
     double m_gamma      = 0;
     double m_initialQ   = 0;
     double m_diffThresh = 0;
+    uint64_t m_actionMask = 0;  // bits of the real actions, when there are at most 64
+
+    size_t m_slotMask   = 0;    // number of slots - 1 for a sparse table, 0 when dense
+    size_t m_slotShift  = 0;    // 64 - log2(slots), for fibonacci hashing
+    size_t m_missingRow = (size_t)-1;   // row read for states without one, sparse only
+    size_t m_drops      = 0;
 
-    std::vector<std::vector<double>> m_Q;
-    std::vector<std::vector<double>> m_P;
-    std::vector<std::vector<size_t>> m_N;
+    AlignedVector<Value> m_Q;       // owned storage, released while attached to a shared file
+    AlignedVector<Value> m_P;
+    std::vector<Count>   m_N;
+    std::vector<uint64_t> m_keys;   // the state held by each slot, sparse only
+    Value * m_q = nullptr;          // the tables, in owned storage or in the shared file
+    Value * m_p = nullptr;
+    Count * m_n = nullptr;
+    uint64_t * m_k = nullptr;
+
+    // set while the table lives in a file that other processes update too
+    std::shared_ptr<MappedFile> m_sharedFile;
+    QTableFileHeader *          m_sharedHeader = nullptr;
+    QTableSharedBlock *         m_sharedBlock = nullptr;
 
     std::vector<size_t> m_maxActions;
+    std::vector<size_t> m_batchStates;     // distinct states of the last batch
+
+    inline bool useMasks() const
+    {
+        return m_numActions <= 64;
+    }
+
+    // sparseRows of 0 gives a dense table with a row for every state, otherwise
+    // the table holds up to sparseRows states, rounded up to a power of two
+    void allocate(size_t numStates, size_t numActions, size_t sparseRows = 0)
+    {
+        const size_t lanes = QRow::Lanes<Value>::Count;
+        m_numStates  = numStates;
+        m_numActions = numActions;
+        m_stride     = (numActions + lanes - 1) / lanes * lanes;
+        m_actionMask = numActions >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << numActions) - 1);
+
+        size_t slots = 0, slotBits = 1;
+        if (sparseRows)
+        {
+            for (slots = 2; slots < sparseRows; slots *= 2) { slotBits++; }
+        }
+        m_slotShift  = 64 - slotBits;
+        m_slotMask   = sparseRows ? slots - 1 : 0;
+        m_numRows    = sparseRows ? slots + 1 : numStates;
+        m_missingRow = sparseRows ? slots : (size_t)-1;
+        m_drops      = 0;
+
+        detachShared(false);
+        m_Q.assign(m_numRows * m_stride, std::numeric_limits<Value>::lowest());
+        m_P.assign(m_numRows * m_stride, 0);
+        m_N.assign(m_numRows * numActions, 0);
+        m_keys.assign(slots, (uint64_t)EmptyKey);
+        m_q = m_Q.data();
+        m_p = m_P.data();
+        m_n = m_N.data();
+        m_k = m_keys.data();
+
+        for (size_t row = 0; row < m_numRows; row++)
+        {
+            std::fill(qRow(row), qRow(row) + numActions, (Value)m_initialQ);
+            std::fill(pRow(row), pRow(row) + numActions, (Value)(1.0 / numActions));
+        }
+    }
+
+    static const uint64_t EmptyKey = ~(uint64_t)0;
+    static const size_t   MaxProbes = 64;
+
+    inline bool isSparse() const                { return m_slotMask != 0; }
+    inline size_t slots() const                 { return m_slotMask ? m_slotMask + 1 : 0; }
+
+    inline size_t homeSlot(uint64_t s) const
+    {
+        return (size_t)((s * 0x9E3779B97F4A7C15ULL) >> m_slotShift) & m_slotMask;
+    }
+
+    // the row of state s, or m_missingRow when a sparse table does not hold it
+    inline size_t findRow(size_t s) const
+    {
+        if (!isSparse()) { return s; }
+
+        size_t slot = homeSlot(s);
+        for (size_t probe = 0; probe < MaxProbes; probe++, slot = (slot + 1) & m_slotMask)
+        {
+            uint64_t key = CellAtomic::Load(m_k[slot]);
+            if (key == s)        { return slot; }
+            if (key == EmptyKey) { break; }
+        }
+        return m_missingRow;
+    }
+
+    // the row of state s, claiming a free slot for it if it has none yet
+    // slots are only ever claimed, never freed, so a probe that reaches an
+    // empty slot knows s is not stored further along
+    inline size_t claimRow(size_t s)
+    {
+        if (!isSparse()) { return s; }
+
+        size_t slot = homeSlot(s);
+        for (size_t probe = 0; probe < MaxProbes; probe++, slot = (slot + 1) & m_slotMask)
+        {
+            uint64_t current = CellAtomic::Load(m_k[slot]);
+            if (current == EmptyKey && CellAtomic::CompareExchange(m_k[slot], current, (uint64_t)s)) { return slot; }
+            if (current == s) { return slot; }
+        }
+
+        CellAtomic::FetchAdd(m_drops, (size_t)1);
+        return m_missingRow;
+    }
+
+    inline Value * qRow(size_t row)             { return m_q + row * m_stride; }
+    inline const Value * qRow(size_t row) const { return m_q + row * m_stride; }
+    inline Value * pRow(size_t row)             { return m_p + row * m_stride; }
+    inline const Value * pRow(size_t row) const { return m_p + row * m_stride; }
+    inline Count * nRow(size_t row)             { return m_n + row * m_numActions; }
+    inline const Count * nRow(size_t row) const { return m_n + row * m_numActions; }
+
+    inline size_t valueCells() const            { return m_numRows * m_stride; }
+    inline size_t countCells() const            { return m_numRows * m_numActions; }
+
+    static uint64_t AlignBlock(uint64_t offset)
+    {
+        return (offset + QTableFileHeader::BlockAlignment - 1) / QTableFileHeader::BlockAlignment * QTableFileHeader::BlockAlignment;
+    }
+
+    // the key block of a sparse table follows the N block, and holds the
+    // number of states the keys index, then one key per slot (numStates - 1)
+    static uint64_t KeysOffset(const QTableFileHeader & header)
+    {
+        return AlignBlock(header.nOffset + header.numStates * header.numActions * header.countBytes);
+    }
+
+    static uint64_t KeysSize(const QTableFileHeader & header)
+    {
+        return (header.flags & QTableFileHeader::Sparse) ? header.numStates * sizeof(uint64_t) : 0;
+    }
+
+    // the header describing this table's layout, with blocks starting at firstBlock
+    QTableFileHeader makeHeader(uint64_t firstBlock) const
+    {
+        QTableFileHeader header = {};
+        memcpy(header.magic, "CWQTABLE", 8);
+        header.version      = QTableFileHeader::CurrentVersion;
+        header.valueBytes   = sizeof(Value);
+        header.countBytes   = sizeof(Count);
+        header.flags        = isSparse() ? QTableFileHeader::Sparse : 0;
+        header.numStates    = m_numRows;
+        header.numActions   = m_numActions;
+        header.stride       = m_stride;
+        header.updates      = numUpdates();
+        header.visited      = numVisited();
+        header.alpha        = m_alpha;
+        header.gamma        = m_gamma;
+        header.initialQ     = m_initialQ;
+        header.qOffset      = AlignBlock(firstBlock);
+        header.pOffset      = AlignBlock(header.qOffset + valueCells() * sizeof(Value));
+        header.nOffset      = AlignBlock(header.pOffset + valueCells() * sizeof(Value));
+        header.dataSize     = header.nOffset + countCells() * sizeof(Count) - sizeof(header);
+        if (isSparse())
+        {
+            header.dataSize = KeysOffset(header) + KeysSize(header) - sizeof(header);
+        }
+        return header;
+    }
+
+    // copies the key block of a sparse table to bytes, which is at the header's key offset
+    void writeKeys(uint8_t * bytes) const
+    {
+        uint64_t numStates = m_numStates;
+        memcpy(bytes, &numStates, sizeof(numStates));
+        memcpy(bytes + sizeof(numStates), m_k, slots() * sizeof(uint64_t));
+    }
+
+    // copies the header and the tables to bytes, at the header's offsets
+    void writeFile(const QTableFileHeader & header, char * bytes) const
+    {
+        memcpy(bytes, &header, sizeof(header));
+        if (valueCells()) { memcpy(bytes + header.qOffset, m_q, valueCells() * sizeof(Value)); }
+        if (valueCells()) { memcpy(bytes + header.pOffset, m_p, valueCells() * sizeof(Value)); }
+        if (countCells()) { memcpy(bytes + header.nOffset, m_n, countCells() * sizeof(Count)); }
+        if (isSparse())   { writeKeys((uint8_t *)bytes + KeysOffset(header)); }
+    }
+
+    static double ReadValue(const uint8_t * bytes, size_t size)
+    {
+        if (size == sizeof(float)) { float v; memcpy(&v, bytes, sizeof(v)); return v; }
+        double v; memcpy(&v, bytes, sizeof(v)); return v;
+    }
+
+    static uint64_t ReadCount(const uint8_t * bytes, size_t size)
+    {
+        uint8_t v8; uint16_t v16; uint32_t v32; uint64_t v64;
+        switch (size)
+        {
+            case 1: memcpy(&v8, bytes, 1);  return v8;
+            case 2: memcpy(&v16, bytes, 2); return v16;
+            case 4: memcpy(&v32, bytes, 4); return v32;
+            default: memcpy(&v64, bytes, 8); return v64;
+        }
+    }
+
+    inline Value maxQ(size_t row) const
+    {
+        return useMasks() ? QRow::Max(qRow(row), m_stride) : *std::max_element(qRow(row), qRow(row) + m_numActions);
+    }
 
 public:
 
-    QLearning() {}
+    QLearningTable() {}
+
+    // the row pointers may point into a mapped file, so tables are not copied
+    QLearningTable(const QLearningTable &) = delete;
+    QLearningTable & operator = (const QLearningTable &) = delete;
+
+    ~QLearningTable()
+    {
+        detachShared(false);
+    }
 
-    QLearning(size_t numStates, size_t numActions, double alpha, double gamma, double initialQ) 
-        : m_numStates   (numStates)
-        , m_numActions  (numActions)
-        , m_alpha       (alpha)
+    // sparseRows bounds the number of states stored, 0 stores all of them
+    QLearningTable(size_t numStates, size_t numActions, double alpha, double gamma, double initialQ, size_t sparseRows = 0)
+        : m_alpha       (alpha)
         , m_gamma       (gamma)
         , m_initialQ    (initialQ)
-        , m_Q           (numStates, std::vector<double>(numActions, initialQ))
-        , m_P           (numStates, std::vector<double>(numActions, 1.0 / numActions))
-        , m_N           (numStates, std::vector<size_t>(numActions, 0))
     {
-     
+        allocate(numStates, numActions, sparseRows);
     }
 
-    void save(const std::string & filename)
+    // serializes the table into the binary checkpoint format, without the checksum
+    // this is only a copy of the three tables, so it is cheap enough to take
+    // on the simulation thread and hand to another thread to finish and write
+    std::shared_ptr<std::vector<char>> snapshot() const
+    {
+        QTableFileHeader header = makeHeader(sizeof(QTableFileHeader));
+
+        auto bytes = std::make_shared<std::vector<char>>(sizeof(header) + header.dataSize, 0);
+        writeFile(header, bytes->data());
+        return bytes;
+    }
+
+    // fills in the checksum of a snapshot, after which it is a complete checkpoint
+    static void FinishSnapshot(std::vector<char> & bytes)
+    {
+        QTableFileHeader header;
+        memcpy(&header, bytes.data(), sizeof(header));
+        header.checksum = QTableFileHeader::Checksum((const uint8_t *)bytes.data() + sizeof(header), bytes.size() - sizeof(header));
+        memcpy(bytes.data(), &header, sizeof(header));
+    }
+
+    // fills in the checksum of a snapshot and writes it out
+    // the file is written under a temporary name and renamed over the old
+    // checkpoint in one step, so there is always a complete checkpoint on disk
+    static bool WriteSnapshot(std::vector<char> & bytes, const std::string & filename)
+    {
+        FinishSnapshot(bytes);
+        return AtomicFile::Write(filename, bytes.data(), bytes.size(), "Q table checkpoint");
+    }
+
+    // writes a binary checkpoint on the calling thread
+    void save(const std::string & filename) const
+    {
+        WriteSnapshot(*snapshot(), filename);
+    }
+
+    // snapshots the table now and writes the checkpoint on the worker thread
+    // if the previous checkpoint is still being written it is finished first,
+    // so snapshots can never pile up in memory
+    void saveAsync(const std::string & filename, BackgroundWorker & worker) const
+    {
+        worker.wait();
+        auto bytes = snapshot();
+        worker.submit([bytes, filename] { WriteSnapshot(*bytes, filename); });
+    }
+
+    // writes the table as whitespace separated text, the format used before
+    // binary checkpoints, which is still handy for inspecting small tables
+    // every state is written, so a sparse table comes out dense
+    void saveText(const std::string & filename) const
     {
         std::ofstream fout(filename);
-        fout << m_numStates << " " << m_numActions << " " << m_updates << " " << m_alpha << " " << m_gamma << " " << m_initialQ << " " << m_updates << " " << m_visited << " \n";
+        fout << m_numStates << " " << m_numActions << " " << numUpdates() << " " << m_alpha << " " << m_gamma << " " << m_initialQ << " " << numUpdates() << " " << numVisited() << " \n";
 
         for (size_t s = 0; s < m_numStates; s++)
         {
+            size_t row = findRow(s);
             for (size_t a = 0; a < m_numActions; a++)
             {
-                fout << m_Q[s][a] << " " << m_N[s][a] << " " << m_P[s][a] << " ";
+                fout << qRow(row)[a] << " " << (size_t)nRow(row)[a] << " " << pRow(row)[a] << " ";
             }
         }
     }
 
+    // loads either a binary checkpoint or the older text format
+    // a live shared table file can be loaded too, which copies whatever the
+    // processes attached to it have written so far
     void load(const std::string & filename)
+    {
+        char magic[8] = {};
+        {
+            std::ifstream fin(filename, std::ios::binary);
+            fin.read(magic, sizeof(magic));
+            if (fin.good() && QTableFileHeader::HasMagic(magic))
+            {
+                fin.close();
+                loadBinary(filename);
+                return;
+            }
+        }
+
+        loadText(filename);
+    }
+
+    void loadText(const std::string & filename)
     {
         std::ifstream fin(filename);
-        fin >> m_numStates >> m_numActions >> m_updates >> m_alpha >> m_gamma >> m_initialQ >> m_updates >> m_visited;
+        size_t numStates = 0, numActions = 0;
+        fin >> numStates >> numActions >> m_updates >> m_alpha >> m_gamma >> m_initialQ >> m_updates >> m_visited;
+        if (numStates != m_numStates || numActions != m_numActions) { allocate(numStates, numActions, isSparse() ? slots() : 0); }
 
+        // a sparse table only stores the states that were visited
+        std::vector<double> q(m_numActions), p(m_numActions);
+        std::vector<size_t> n(m_numActions);
         for (size_t s = 0; s < m_numStates; s++)
         {
             for (size_t a = 0; a < m_numActions; a++)
             {
-                fin >> m_Q[s][a] >> m_N[s][a] >> m_P[s][a];
+                fin >> q[a] >> n[a] >> p[a];
+            }
+
+            bool visited = std::any_of(n.begin(), n.end(), [](size_t count) { return count > 0; });
+            size_t row = !isSparse() || visited ? claimRow(s) : m_missingRow;
+            if (row == m_missingRow) { continue; }
+
+            for (size_t a = 0; a < m_numActions; a++)
+            {
+                qRow(row)[a] = (Value)q[a];
+                nRow(row)[a] = (Count)std::min<size_t>(n[a], std::numeric_limits<Count>::max());
+                pRow(row)[a] = (Value)p[a];
             }
         }
     }
 
-    // Select an action from our policy at a given state s
-    size_t selectActionFromPolicy(size_t s)
+    // maps a binary checkpoint and copies its blocks into the table
+    void loadBinary(const std::string & filename)
     {
-        double maxQ = *std::max_element(m_Q[s].begin(), m_Q[s].end());
+        MappedFile file;
+        if (!file.openRead(filename) || file.size() < sizeof(QTableFileHeader))
+        {
+            std::cerr << "Q table checkpoint could not be mapped: " << filename << "\n";
+            exit(-1);
+        }
 
-        m_maxActions.clear();
-        for (size_t a=0; a<m_Q[s].size(); a++) {
-            if (m_Q[s][a] == maxQ) {
-                m_maxActions.push_back(a); 
+        loadBinary(file.data(), file.size(), filename);
+    }
+
+    // copies a binary checkpoint held in memory into the table, filename is
+    // only used in errors. checkpoints written with another value or counter
+    // type are converted, and the table becomes dense or sparse like the checkpoint
+    void loadBinary(const uint8_t * data, size_t size, const std::string & filename)
+    {
+        if (size < sizeof(QTableFileHeader) || !QTableFileHeader::HasMagic((const char *)data))
+        {
+            std::cerr << "Q table checkpoint is truncated or corrupt: " << filename << "\n";
+            exit(-1);
+        }
+
+        QTableFileHeader header;
+        memcpy(&header, data, sizeof(header));
+        bool validTypes = (header.valueBytes == 4 || header.valueBytes == 8)
+                       && (header.countBytes == 1 || header.countBytes == 2 || header.countBytes == 4 || header.countBytes == 8);
+        if (header.version != QTableFileHeader::CurrentVersion || !validTypes)
+        {
+            std::cerr << "Q table checkpoint has unsupported version or types: " << filename << "\n";
+            exit(-1);
+        }
+
+        bool sizesValid = size >= sizeof(header) + header.dataSize
+                       && header.stride >= header.numActions
+                       && header.qOffset + header.numStates * header.stride * header.valueBytes <= sizeof(header) + header.dataSize
+                       && header.pOffset + header.numStates * header.stride * header.valueBytes <= sizeof(header) + header.dataSize
+                       && header.nOffset + header.numStates * header.numActions * header.countBytes <= sizeof(header) + header.dataSize;
+        bool sparse = (header.flags & QTableFileHeader::Sparse) != 0;
+        size_t numSlots = sparse ? (size_t)header.numStates - 1 : 0;
+        if (sparse)
+        {
+            sizesValid = sizesValid && numSlots >= 2 && (numSlots & (numSlots - 1)) == 0
+                      && KeysOffset(header) + KeysSize(header) <= sizeof(header) + header.dataSize;
+        }
+        bool live = (header.flags & QTableFileHeader::Live) != 0;
+        if (!sizesValid || (!live && QTableFileHeader::Checksum(data + sizeof(header), (size_t)header.dataSize) != header.checksum))
+        {
+            std::cerr << "Q table checkpoint is truncated or corrupt: " << filename << "\n";
+            exit(-1);
+        }
+
+        m_alpha    = header.alpha;
+        m_gamma    = header.gamma;
+        m_initialQ = header.initialQ;
+        uint64_t numStates = header.numStates;
+        if (sparse) { memcpy(&numStates, data + KeysOffset(header), sizeof(numStates)); }
+        allocate((size_t)numStates, (size_t)header.numActions, numSlots);
+        if (sparse) { memcpy(m_k, data + KeysOffset(header) + sizeof(numStates), numSlots * sizeof(uint64_t)); }
+        m_updates  = (size_t)header.updates;
+        m_visited  = (size_t)header.visited;
+
+        const uint8_t * q = data + header.qOffset;
+        const uint8_t * p = data + header.pOffset;
+        const uint8_t * n = data + header.nOffset;
+
+        if (header.valueBytes == sizeof(Value) && header.stride == m_stride)
+        {
+            memcpy(m_q, q, valueCells() * sizeof(Value));
+            memcpy(m_p, p, valueCells() * sizeof(Value));
+        }
+        else
+        {
+            for (size_t row = 0; row < m_numRows; row++)
+            {
+                for (size_t a = 0; a < m_numActions; a++)
+                {
+                    size_t offset = (row * header.stride + a) * header.valueBytes;
+                    qRow(row)[a] = (Value)ReadValue(q + offset, header.valueBytes);
+                    pRow(row)[a] = (Value)ReadValue(p + offset, header.valueBytes);
+                }
+            }
+        }
+
+        if (header.countBytes == sizeof(Count))
+        {
+            memcpy(m_n, n, countCells() * sizeof(Count));
+        }
+        else
+        {
+            for (size_t i = 0; i < countCells(); i++)
+            {
+                uint64_t count = ReadCount(n + i * header.countBytes, header.countBytes);
+                m_n[i] = (Count)std::min<uint64_t>(count, std::numeric_limits<Count>::max());
             }
         }
-        // return a random action from the maximums
-        return m_maxActions[rand() % m_maxActions.size()];
     }
 
-    size_t selectMostChosenAction(size_t s) 
+    // Select an action from our policy at a given state s
+    // ties are broken with the supplied random generator and no member data is
+    // modified, so robots on different threads may call this concurrently
+    template <class RNG>
+    size_t selectActionFromPolicy(size_t s, RNG & rng) const
+    {
+        const Value * q = qRow(findRow(s));
+
+        if (useMasks())
+        {
+            uint64_t ties;
+            QRow::MaxTies(q, m_stride, ties);
+            ties &= m_actionMask;
+
+            // a table shared with other threads can change between the max and
+            // the compare, leaving no ties, in which case every action is one
+            if (!ties) { ties = m_actionMask; }
+
+            // return a random action from the maximums
+            size_t choice = rng() % QRow::CountBits(ties);
+            while (choice--) { ties &= ties - 1; }
+            return QRow::LowestBit(ties);
+        }
+
+        Value maxVal = *std::max_element(q, q + m_numActions);
+        size_t numMax = std::count(q, q + m_numActions, maxVal);
+        if (numMax == 0) { return rng() % m_numActions; }
+        size_t choice = rng() % numMax;
+        for (size_t a = 0; a < m_numActions; a++)
+        {
+            if (q[a] == maxVal && choice-- == 0) { return a; }
+        }
+        return 0;
+    }
+
+    size_t selectMostChosenAction(size_t s)
     {
-        auto maxVisits = std::max_element(m_N[s].begin(), m_N[s].end());
+        const Count * n = nRow(findRow(s));
+        auto maxVisits = std::max_element(n, n + m_numActions);
         if (*maxVisits == 0) { std::cout << "Warning, state unvisited: " << s << "\n"; }
-        return maxVisits - m_N[s].begin();
+        return maxVisits - n;
     }
 
     // Update the value estimate of Q[s][a] based on a given sample
     // Note: s and a must be integer hash of state and action
-    void updateValue(size_t s, size_t a, double r, size_t ns) 
+    // a sparse table that has no row left for s drops the update
+    // returns the TD error of the update, 0 if it was dropped
+    double updateValue(size_t s, size_t a, double r, size_t ns)
     {
+        size_t row = claimRow(s);
+        if (row == m_missingRow) { return 0; }
+
         ++m_updates;
-        if (m_N[s][a] == 0) { m_visited++; }
-        ++m_N[s][a];
-        double maxNSQ = *std::max_element(m_Q[ns].begin(), m_Q[ns].end());
-        m_Q[s][a] += m_alpha * (r + m_gamma*maxNSQ - m_Q[s][a]);
+        Count & n = nRow(row)[a];
+        if (n == 0) { m_visited++; }
+        if (n != std::numeric_limits<Count>::max()) { ++n; }
+        double maxNSQ = maxQ(findRow(ns));
+        Value & q = qRow(row)[a];
+        double tdError = r + m_gamma*maxNSQ - q;
+        q = (Value)(q + m_alpha * tdError);
+        return tdError;
+    }
+
+    // updateValue for a sample replayed from past experience, with the
+    // learning rate scaled by weight. the pair was counted when it was first
+    // learned from, so the visit counts and update count are left alone
+    double replayValue(size_t s, size_t a, double r, size_t ns, double weight = 1.0)
+    {
+        size_t row = findRow(s);
+        if (row == m_missingRow) { return 0; }
+
+        double maxNSQ = maxQ(findRow(ns));
+        Value & q = qRow(row)[a];
+        double tdError = r + m_gamma*maxNSQ - q;
+        q = (Value)(q + m_alpha * weight * tdError);
+        return tdError;
     }
 
     void updatePolicy(size_t s) {
-        
+
+        size_t row = findRow(s);
+        if (row == m_missingRow) { return; }
+
+        Value * q = qRow(row);
+        Value * p = pRow(row);
+
         // find the maximum value of any action at the given state
-        double maxVal = *std::max_element(m_Q[s].begin(), m_Q[s].end());
+        Value maxVal = maxQ(row);
+        std::fill(p, p + m_numActions, (Value)0);
+
+        // record all of the actions which have the max value, and
+        // set all max action value propabilities accordingly
+        if (useMasks())
+        {
+            uint64_t maxActions = QRow::WithinMask(q, m_stride, maxVal, (Value)m_diffThresh) & m_actionMask;
+            Value prob = (Value)(1.0 / QRow::CountBits(maxActions));
+            for (; maxActions; maxActions &= maxActions - 1) { p[QRow::LowestBit(maxActions)] = prob; }
+            return;
+        }
 
-        // record all of the actions which have the max value
         m_maxActions.clear();
-        for (size_t a = 0; a < m_Q[s].size(); ++a) {
-            if (fabs(m_Q[s][a] - maxVal) < m_diffThresh) {
+        for (size_t a = 0; a < m_numActions; ++a) {
+            if (fabs(q[a] - maxVal) < m_diffThresh) {
                 m_maxActions.push_back(a);
             }
         }
 
-        std::fill(m_P[s].begin(), m_P[s].end(), 0.0);
-
-        // set all max action value propabilities accordingly
         for (size_t a=0; a<m_maxActions.size(); ++a) {
-            m_P[s][m_maxActions[a]] = 1.0 / m_maxActions.size();
+            p[m_maxActions[a]] = (Value)(1.0 / m_maxActions.size());
+        }
+    }
+
+    // Applies a batch of samples that all received the same reward
+    // The TD updates run in batch order, since each one reads the current
+    // row of its next state, but policies are only refreshed afterwards, once
+    // for each distinct state in the batch rather than once per sample
+    void updateBatch(const size_t * states, const size_t * actions, const size_t * nextStates, size_t count, double r)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            updateValue(states[i], actions[i], r, nextStates[i]);
+        }
+
+        m_batchStates.assign(states, states + count);
+        std::sort(m_batchStates.begin(), m_batchStates.end());
+        m_batchStates.erase(std::unique(m_batchStates.begin(), m_batchStates.end()), m_batchStates.end());
+
+        for (size_t s : m_batchStates)
+        {
+            updatePolicy(s);
         }
     }
 
+    // Hogwild versions of the updates, for many threads sharing one table
+    // Cells are read and written with relaxed atomics (see CellAtomic) and no
+    // locks: a concurrent update to the same cell may be lost, which tabular
+    // Q-learning tolerates, but no cell is ever torn (rows are still scanned
+    // with plain aligned vector loads, which never see half a store on the
+    // targets we build for, x86 and ARM64). Visit counts are incremented
+    // atomically, so the thread that takes a count from 0 is the only one that
+    // counts the pair as visited, and the totals in stats stay exact
+    void updateValueShared(size_t s, size_t a, double r, size_t ns, QLearningStats & stats)
+    {
+        size_t row = claimRow(s);
+        if (row == m_missingRow) { return; }
+
+        ++stats.updates;
+        Count & n = nRow(row)[a];
+        Count count = CellAtomic::Load(n);
+        while (count != std::numeric_limits<Count>::max()
+            && !CellAtomic::CompareExchange(n, count, (Count)(count + 1))) {}
+        if (count == 0) { stats.visited++; }
+
+        double maxNSQ = maxQ(findRow(ns));
+        Value & q = qRow(row)[a];
+        Value oldQ = CellAtomic::Load(q);
+        CellAtomic::Store(q, (Value)(oldQ + m_alpha * (r + m_gamma*maxNSQ - oldQ)));
+    }
+
+    // stats is only used for its scratch space
+    void updatePolicyShared(size_t s, QLearningStats & stats)
+    {
+        size_t row = findRow(s);
+        if (row == m_missingRow) { return; }
+
+        Value * q = qRow(row);
+        Value * p = pRow(row);
+        Value maxVal = maxQ(row);
+
+        // decide which actions are max once, since the row may change under us
+        if (useMasks())
+        {
+            uint64_t maxActions = QRow::WithinMask(q, m_stride, maxVal, (Value)m_diffThresh) & m_actionMask;
+            Value prob = (Value)(1.0 / QRow::CountBits(maxActions));
+            for (size_t a = 0; a < m_numActions; a++)
+            {
+                CellAtomic::Store(p[a], ((maxActions >> a) & 1) ? prob : (Value)0);
+            }
+            return;
+        }
+
+        std::vector<char> & isMax = stats.isMax;
+        isMax.resize(m_numActions);
+        for (size_t a = 0; a < m_numActions; a++) { isMax[a] = fabs(q[a] - maxVal) < m_diffThresh; }
+
+        size_t numMax = std::count(isMax.begin(), isMax.end(), 1);
+        for (size_t a = 0; a < m_numActions; a++)
+        {
+            CellAtomic::Store(p[a], isMax[a] ? (Value)(1.0 / numMax) : (Value)0);
+        }
+    }
+
+    // updateBatch for a shared table, the per-batch scratch lives in the caller's stats
+    void updateBatchShared(const size_t * states, const size_t * actions, const size_t * nextStates, size_t count, double r, QLearningStats & stats)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            updateValueShared(states[i], actions[i], r, nextStates[i], stats);
+        }
+
+        std::vector<size_t> & batchStates = stats.batchStates;
+        batchStates.assign(states, states + count);
+        std::sort(batchStates.begin(), batchStates.end());
+        batchStates.erase(std::unique(batchStates.begin(), batchStates.end()), batchStates.end());
+
+        for (size_t s : batchStates)
+        {
+            updatePolicyShared(s, stats);
+        }
+    }
+
+    // adds the counters of a thread that updated this table with the shared
+    // functions. The counters are added atomically, to the table's own or to
+    // a shared file's header, so threads and processes merge after every
+    // batch and the table's counts stay current while they run
+    void mergeStats(const QLearningStats & stats)
+    {
+        if (m_sharedHeader)
+        {
+            CellAtomic::FetchAdd(m_sharedHeader->updates, (uint64_t)stats.updates);
+            CellAtomic::FetchAdd(m_sharedHeader->visited, (uint64_t)stats.visited);
+            CellAtomic::FetchAdd(m_sharedBlock->merges, (uint64_t)1);
+            return;
+        }
+
+        CellAtomic::FetchAdd(m_updates, stats.updates);
+        CellAtomic::FetchAdd(m_visited, stats.visited);
+    }
+
+    // Moves the table into a file that several processes map at once
+    // The file has the checkpoint layout with the Live flag set, followed by a
+    // QTableSharedBlock, so it can also be loaded like any checkpoint. The
+    // first process to attach builds the file from its current table (fresh
+    // or loaded) under a name of its own and moves it into place, and the
+    // others adopt the file's contents; an existing file keeps its contents,
+    // so learning resumes where it stopped. A file is only ever seen whole,
+    // so a process that crashes while creating it leaves no file behind and
+    // the next process to attach simply creates it again.
+    // Every process must then update with the shared functions, which use the
+    // same relaxed atomics as threads do, and merge its stats periodically.
+    // A process that crashes leaves the table as it last wrote it, since the
+    // pages belong to the file rather than to any one process.
+    void attachShared(const std::string & filename)
+    {
+        QTableFileHeader header = makeHeader(sizeof(QTableFileHeader) + sizeof(QTableSharedBlock));
+        header.flags |= QTableFileHeader::Live;
+        size_t fileSize = (size_t)(sizeof(header) + header.dataSize);
+
+        // if processes race to create the file one of them wins and the rest adopt its file
+        if (!AtomicFile::Exists(filename))
+        {
+            std::vector<char> bytes(fileSize, 0);
+            writeFile(header, bytes.data());
+            QTableSharedBlock newBlock = {};
+            newBlock.state = QTableSharedBlock::Ready;
+            memcpy(bytes.data() + sizeof(header), &newBlock, sizeof(newBlock));
+            AtomicFile::Create(filename, bytes.data(), bytes.size(), "shared Q table");
+        }
+
+        auto file = std::make_shared<MappedFile>();
+        if (!file->openReadWrite(filename, 0) || file->size() < sizeof(QTableFileHeader) + sizeof(QTableSharedBlock))
+        {
+            std::cerr << "Shared Q table file could not be mapped: " << filename << "\n";
+            exit(-1);
+        }
+
+        uint8_t * data = file->writableData();
+        QTableFileHeader * fileHeader = reinterpret_cast<QTableFileHeader *>(data);
+        QTableSharedBlock * block = reinterpret_cast<QTableSharedBlock *>(data + sizeof(QTableFileHeader));
+        if (!QTableFileHeader::HasMagic(fileHeader->magic))
+        {
+            std::cerr << "File is not a Q table: " << filename << "\n";
+            exit(-1);
+        }
+        if (!(fileHeader->flags & QTableFileHeader::Live))
+        {
+            std::cerr << "File is a Q table checkpoint, not a shared table, load it with loadPolicy instead: " << filename << "\n";
+            exit(-1);
+        }
+        if (CellAtomic::Load(block->state) != QTableSharedBlock::Ready)
+        {
+            std::cerr << "Shared Q table file was left half initialized by an older version, delete it: " << filename << "\n";
+            exit(-1);
+        }
+
+        bool matches = file->size() >= fileSize
+                    && fileHeader->valueBytes == header.valueBytes && fileHeader->countBytes == header.countBytes
+                    && fileHeader->numStates == header.numStates && fileHeader->numActions == header.numActions
+                    && fileHeader->stride == header.stride && fileHeader->qOffset == header.qOffset
+                    && fileHeader->pOffset == header.pOffset && fileHeader->nOffset == header.nOffset
+                    && fileHeader->flags == header.flags;
+        if (!matches)
+        {
+            std::cerr << "Shared Q table file has different dimensions or types than this table: " << filename << "\n";
+            exit(-1);
+        }
+
+        CellAtomic::FetchAdd(block->attaches, (uint64_t)1);
+
+        m_sharedFile   = file;
+        m_sharedHeader = fileHeader;
+        m_sharedBlock  = block;
+        m_q = reinterpret_cast<Value *>(data + header.qOffset);
+        m_p = reinterpret_cast<Value *>(data + header.pOffset);
+        m_n = reinterpret_cast<Count *>(data + header.nOffset);
+        if (isSparse()) { m_k = reinterpret_cast<uint64_t *>(data + KeysOffset(header) + sizeof(uint64_t)); }
+
+        // the file is the table now
+        AlignedVector<Value>().swap(m_Q);
+        AlignedVector<Value>().swap(m_P);
+        std::vector<Count>().swap(m_N);
+        std::vector<uint64_t>().swap(m_keys);
+    }
+
+    // unmaps the shared file, copying its current contents back into memory
+    // when keepContents is set so the table stays usable
+    void detachShared(bool keepContents = true)
+    {
+        if (!m_sharedFile) { return; }
+
+        if (keepContents)
+        {
+            m_updates = numUpdates();
+            m_visited = numVisited();
+            m_Q.assign(m_q, m_q + valueCells());
+            m_P.assign(m_p, m_p + valueCells());
+            m_N.assign(m_n, m_n + countCells());
+            m_keys.assign(m_k, m_k + slots());
+        }
+
+        CellAtomic::FetchAdd(m_sharedBlock->detaches, (uint64_t)1);
+        m_sharedFile->flush();
+        m_sharedFile.reset();
+        m_sharedHeader = nullptr;
+        m_sharedBlock  = nullptr;
+        m_q = m_Q.data();
+        m_p = m_P.data();
+        m_n = m_N.data();
+        m_k = m_keys.data();
+    }
+
+    bool isShared() const
+    {
+        return m_sharedFile != nullptr;
+    }
+
+    QTableSharedStats getSharedStats() const
+    {
+        QTableSharedStats stats;
+        if (!m_sharedBlock) { return stats; }
+        stats.attaches = (size_t)CellAtomic::Load(m_sharedBlock->attaches);
+        stats.detaches = (size_t)CellAtomic::Load(m_sharedBlock->detaches);
+        stats.merges   = (size_t)CellAtomic::Load(m_sharedBlock->merges);
+        stats.updates  = numUpdates();
+        stats.visited  = numVisited();
+        return stats;
+    }
+
+    // slot occupancy and probe lengths of a sparse table, all zero for a dense one
+    // this scans every slot, so it is meant for status displays and summaries
+    QTableSparseStats getSparseStats() const
+    {
+        QTableSparseStats stats;
+        stats.slots = slots();
+        stats.drops = CellAtomic::Load(m_drops);
+
+        size_t totalProbe = 0;
+        for (size_t slot = 0; slot < stats.slots; slot++)
+        {
+            uint64_t key = CellAtomic::Load(m_k[slot]);
+            if (key == EmptyKey) { continue; }
+
+            size_t probe = (slot - homeSlot(key)) & m_slotMask;
+            stats.used++;
+            stats.maxProbe = std::max(stats.maxProbe, probe);
+            totalProbe += probe;
+        }
+        stats.meanProbe = stats.used ? (double)totalProbe / stats.used : 0;
+        return stats;
+    }
+
     size_t size() const
     {
         return m_numStates * m_numActions;
     }
 
+    size_t numStates() const
+    {
+        return m_numStates;
+    }
+
+    // the rows of Q, and the row holding state s, so a fixed table can be
+    // summarized once per row. states a sparse table does not hold all read
+    // the one row of initial values
+    size_t numRows() const
+    {
+        return m_numRows;
+    }
+
+    size_t rowOf(size_t s) const
+    {
+        return findRow(s);
+    }
+
+    // the actions tied for the largest value of a row, for at most 64 actions
+    uint64_t greedyMask(size_t row) const
+    {
+        uint64_t ties;
+        QRow::MaxTies(qRow(row), m_stride, ties);
+        ties &= m_actionMask;
+        return ties ? ties : m_actionMask;
+    }
+
+    bool hasGreedyMasks() const
+    {
+        return useMasks();
+    }
+
+    size_t numActions() const
+    {
+        return m_numActions;
+    }
+
     double getCoverage() const
     {
-        return (double)m_visited / (m_numStates * m_numActions);
+        return (double)numVisited() / (m_numStates * m_numActions);
     }
 
     size_t numUpdates() const
     {
-        return m_updates;
+        return m_sharedHeader ? (size_t)CellAtomic::Load(m_sharedHeader->updates) : CellAtomic::Load(m_updates);
+    }
+
+    size_t numVisited() const
+    {
+        return m_sharedHeader ? (size_t)CellAtomic::Load(m_sharedHeader->visited) : CellAtomic::Load(m_visited);
     }
-};
\ No newline at end of file
+};
+
+// the table used by the experiments, switch to float to halve its size
+typedef QLearningTable<double, uint32_t> QLearning;
@@ -4,13 +4,20 @@
 #include <fstream>
 #include <string>
 #include <functional>
+#include <random>
 
 #include "CWaggle.h"
 #include "GUI.hpp"
 #include "QLearning.hpp"
+#include "MetricsWriter.hpp"
 #include "Eval.hpp"
 #include "OrbitalController.hpp"
 #include "Hash.hpp"
+#include "ExperimentCheckpoint.hpp"
+#include "ReplayBuffer.hpp"
+#include "TileCoding.hpp"
+#include "PolicyEvaluation.hpp"
+#include "TransitionDataset.hpp"
 
 struct RLExperimentConfig
 {
@@ -26,6 +33,9 @@ struct RLExperimentConfig
     // Simulation Parameters
     double simTimeStep  = 1.0;
     double renderSteps  = 1;
+    size_t controlSkip  = 1;    // physics steps each robot holds an action before sensing and deciding again
+    size_t numThreads   = 1;
+    size_t seed         = 0;
 
     // Q-Learning Parameters
     size_t maxTimeSteps = 0;
@@ -38,15 +48,45 @@ struct RLExperimentConfig
     double gamma        = 0.9;
     double epsilon      = 0.1;
 
-    HashFunction hashFunction;
+    std::string hashFunction;
+    HashSpec hashSpec;          // hashField lines, which replace the named hashFunction
 
     size_t writePlotSkip    = 0;
     std::string plotFile   = "";
+    std::string plotFormat = "text";    // text, or binary for the columnar format of MetricsWriter
     size_t saveQSkip = 0;
     std::string saveQFile;
     size_t loadQ = 0;
     std::string loadQFile;
     double resetEval    = 0;
+    size_t hogwildWorlds = 1;   // worlds learning into one shared table at once, one thread each
+    std::string outputDir = "gnuplot";   // where results and the run summary are written
+    std::string sharedTable;    // file the table lives in, shared with other processes given the same file
+    size_t sparseRows   = 0;    // store at most this many states in a sparse table, 0 for a dense table
+    size_t checkpointSkip = 0;  // steps between experiment checkpoints, 0 for none
+    std::string checkpointFile;
+    size_t resume = 0;          // carry on from resumeFile if it exists, otherwise start a new run
+    std::string resumeFile;
+    size_t replayCapacity = 0;  // transitions kept for replay, 0 for no replay
+    size_t replayUpdates = 0;   // transitions replayed every simulation step
+    double replayAlpha  = 0;    // priority exponent, 0 replays uniformly
+    double replayBeta   = 0;    // importance weight exponent for prioritized replay
+    size_t transitionChunkRows = 0; // transitions per chunk of the dataset file, 0 for no dataset
+    std::string transitionFile;
+
+    // the learner, table for the hashed Q table or tiles for tile coding
+    std::string learner = "table";
+    std::vector<TileFeatureSpec> tileFeatures;
+    size_t numTilings   = 8;
+    size_t tilesPerFeature = 8;
+    size_t tileRows     = 1 << 16;
+
+    size_t evalEpisodes = 0;    // evaluate the loaded policy greedily over this many episodes instead of training
+    size_t evalMaxSteps = 0;    // steps an evaluation episode may take to form, 0 for maxTimeSteps
+
+    size_t rangeRays    = 0;    // range rays given to every robot as features range[i], 0 for none
+    double rangeFov     = 360;  // degrees the rays are spread over
+    double rangeMax     = 0;    // furthest a ray sees
 
     std::vector<double> actions = { };
 
@@ -74,6 +114,9 @@ struct RLExperimentConfig
             else if (token == "puckRadius")     { fin >> puckRadius; }
             else if (token == "simTimeStep")    { fin >> simTimeStep; }
             else if (token == "renderSkip")     { fin >> renderSteps; }
+            else if (token == "controlSkip")    { fin >> controlSkip; }
+            else if (token == "numThreads")     { fin >> numThreads; }
+            else if (token == "seed")           { fin >> seed; }
             else if (token == "forwardSpeed")   { fin >> occ.forwardSpeed; }
             else if (token == "angularSpeed")   { fin >> occ.maxAngularSpeed; }
             else if (token == "outieThreshold") { fin >> occ.thresholds[0]; }
@@ -87,13 +130,37 @@ struct RLExperimentConfig
             else if (token == "resetEval")      { fin >> resetEval; }
             else if (token == "writePlotSkip")  { fin >> writePlotSkip; }
             else if (token == "plotFilename")   { fin >> plotFile; }
+            else if (token == "plotFormat")     { fin >> plotFormat; }
             else if (token == "qLearning")      { fin >> qLearning; }
             else if (token == "savePolicy")     { fin >> saveQSkip >> saveQFile; }
             else if (token == "loadPolicy")     { fin >> loadQ >> loadQFile; }
+            else if (token == "outputDir")      { fin >> outputDir; }
+            else if (token == "hogwildWorlds")  { fin >> hogwildWorlds; }
+            else if (token == "sharedTable")    { fin >> sharedTable; }
+            else if (token == "sparseRows")     { fin >> sparseRows; }
+            else if (token == "saveCheckpoint") { fin >> checkpointSkip >> checkpointFile; }
+            else if (token == "resumeCheckpoint") { fin >> resume >> resumeFile; }
+            else if (token == "replay")         { fin >> replayCapacity >> replayUpdates; }
+            else if (token == "replayPriority") { fin >> replayAlpha >> replayBeta; }
+            else if (token == "saveTransitions") { fin >> transitionChunkRows >> transitionFile; }
+            else if (token == "learner")        { fin >> learner; }
+            else if (token == "tileCoding")     { fin >> numTilings >> tilesPerFeature >> tileRows; }
+            else if (token == "evaluate")       { fin >> evalEpisodes >> evalMaxSteps; }
+            else if (token == "rangeSensor")    { fin >> rangeRays >> rangeFov >> rangeMax; }
+            else if (token == "tileFeature")
+            {
+                std::string feature;
+                if (std::getline(fin, feature)) { tileFeatures.push_back(TileFeatureSpec::Parse(feature)); }
+            }
+            else if (token == "hashField")
+            {
+                std::string field;
+                if (std::getline(fin, field)) { hashSpec.push_back(HashFieldSpec::Parse(field)); }
+            }
             else if (token == "hashFunction")   
             { 
                 fin >> token;
-                hashFunction = Hash::GetHashData(token).Function; 
+                hashFunction = token;
                 numStates    = Hash::GetHashData(token).MaxHashSize;
             }
             else if (token == "actions") 
@@ -106,29 +173,112 @@ struct RLExperimentConfig
                 }
             }
         }
+
+        if (!hashSpec.empty()) { numStates = HashSpecSize(hashSpec); }
+    }
+};
+
+// The results of one run, written to summary.txt for cwaggle_sweep
+struct RLRunSummary
+{
+    size_t formations       = 0;
+    size_t firstFormation   = 0;    // step of the first formation, or the number of steps if there was none
+    size_t steps            = 0;
+    double coverage         = 0;
+    double finalEval        = 0;
+    double stepsPerSecond   = 0;
+
+    // one 'key value' line per result
+    void write(const std::string & filename) const
+    {
+        std::ofstream fout(filename);
+        fout << "formations "      << formations << "\n";
+        fout << "firstFormation "  << firstFormation << "\n";
+        fout << "steps "           << steps << "\n";
+        fout << "coverage "        << coverage << "\n";
+        fout << "finalEval "       << finalEval << "\n";
+        fout << "stepsPerSecond "  << stepsPerSecond << "\n";
     }
 };
 
 class RLExperiment
 {
     RLExperimentConfig          m_config;
-    QLearning                   m_QL;
+    std::shared_ptr<QLearning>  m_QL;               // null when learning with tile coding
+    std::shared_ptr<TileCodedQ> m_tiles;            // null when learning with the table
+
+    // in hogwild mode the table is shared with experiments on other threads,
+    // and with a sharedTable file also with other processes, and updated with
+    // the lock-free shared functions, counting into m_qStats, which is merged
+    // into the table after every batch
+    bool                        m_sharedQ = false;
+    bool                        m_saveCheckpoints = true;
+    QLearningStats              m_qStats;
 
     std::shared_ptr<GUI>        m_gui;
     std::shared_ptr<Simulator>  m_sim;
 
-    std::vector<Entity>         m_robotsActed;
+    // the sense-decide-act phase is split across this pool by robot index
+    // each pool thread owns one random generator so action selection is
+    // reproducible for a given seed and thread count
+    std::shared_ptr<ThreadPool> m_pool;
+    std::vector<std::mt19937>   m_rngs;
+    std::mt19937                m_worldRng;         // places each new world, and seeds its simulator
+
+    // past transitions, replayed through the table every step
+    ReplayBuffer                m_replay;
+    std::mt19937                m_replayRng;
+    std::vector<size_t>         m_replaySlots;
+    std::vector<double>         m_replayWeights;
+    std::vector<size_t>         m_replayStates;
+
+    std::shared_ptr<StateHasher> m_hasher;          // bound to the robots' sensor layout
+    std::vector<const double *> m_observations;     // the observations of a pass, hashed a chunk at a time
+
+    // robots decide every controlSkip steps and hold their action in between
+    // a decision waits as the robot's pending transition until the step
+    // before its next one, whose observation is its next state, and then
+    // joins the batch. with a controlSkip of 1 that is the step it was made
+    static const size_t         NoAction = (size_t)-1;
+    std::vector<size_t>         m_deciding;         // robots sensing and deciding this step
+    std::vector<size_t>         m_completing;       // robots whose pending transition joins the batch this step
+    std::vector<size_t>         m_decisionStates;
+    std::vector<size_t>         m_heldActions;      // each robot's last action, NoAction before its first
+    std::vector<uint8_t>        m_hasPending;
+    std::vector<size_t>         m_pendingStates;
+    std::vector<size_t>         m_pendingSteps;
+    std::vector<uint32_t>       m_pendingActive;    // with tile coding
+    std::vector<double>         m_pendingObs;       // with a transition dataset
+
+    std::vector<size_t>         m_batchRobots;      // the robot of each batch entry
+    std::vector<size_t>         m_batchSteps;       // the step each batch entry's action was chosen on
     std::vector<size_t>         m_states;
     std::vector<size_t>         m_actions;
     std::vector<size_t>         m_nextStates;
+    std::vector<uint32_t>       m_activeStates;     // with tile coding, the active rows of each batch entry
+    std::vector<uint32_t>       m_activeNextStates;
     size_t                      m_stepsUntilRLUpdate = 1;
 
     size_t                      m_simulationSteps = 0;
     double                      m_simulationTime = 0;
     Timer                       m_simTimer;
     double                      m_previousEval = 0;
+    Eval::PuckThresholdTracker  m_evalTracker;      // the puck evaluation, kept up to date every step
     size_t                      m_formations = 0;
-    std::ofstream               m_fout;
+    MetricsWriter               m_metrics;          // the plot file, written off the simulation thread
+    size_t                      m_stepSeries = 0;
+    size_t                      m_evalSeries = 0;
+    size_t                      m_formationSeries = 0;
+    size_t                      m_coverageSeries = 0;
+    BackgroundWorker            m_checkpointWriter; // writes Q table and experiment checkpoints off the simulation thread
+    size_t                      m_resumedStep = 0;  // step a resumed run carried on from, which is not checkpointed again
+
+    // every transition learned from, with the robots' raw observations, for offline training
+    TransitionDatasetWriter     m_dataset;
+    size_t                      m_datasetFeatures = 0;
+    std::vector<double>         m_datasetObs;       // the observations of each batch entry
+    std::vector<double>         m_datasetNextObs;
+    std::vector<uint8_t>        m_datasetTerminal;  // batch entries whose step ended in a formation
 
     std::stringstream           m_status;
 
@@ -142,12 +292,31 @@ class RLExperiment
         (
             m_config.width, m_config.height,
             m_config.numRobots, m_config.robotRadius,
-            m_config.numPucks, m_config.puckRadius
+            m_config.numPucks, m_config.puckRadius,
+            m_worldRng
         );
+        ExampleWorlds::AddRangeSensors(world, "range", m_config.rangeRays, m_config.rangeFov, m_config.rangeMax);
 
         m_sim = std::make_shared<Simulator>(world);
+        m_sim->getRNG().seed(m_worldRng());
+
+        // every robot in the square world shares one sensor layout
+        auto & robots = world->getEntities("robot");
+        if (!robots.empty() && m_tiles)
+        {
+            m_tiles->bind(SensorTools::GetLayout(robots[0]));
+        }
+        else if (!robots.empty())
+        {
+            m_hasher = Hash::Bind(m_config.hashFunction, m_config.hashSpec, SensorTools::GetLayout(robots[0]));
+        }
+
+        m_evalTracker  = Eval::PuckThresholdTracker(m_sim->getWorld(), m_config.occ.thresholds[0], m_config.occ.thresholds[1]);
+        m_previousEval = m_evalTracker.value();
 
-        m_previousEval = Eval::PuckAvgThresholdDiff(m_sim->getWorld(), m_config.occ.thresholds[0], m_config.occ.thresholds[1]);
+        // the robots of a new world have decided nothing yet
+        m_heldActions.assign(robots.size(), (size_t)NoAction);
+        m_hasPending.assign(robots.size(), 0);
         
         if (m_gui)
         {
@@ -180,38 +349,315 @@ class RLExperiment
         return EntityAction(m_config.occ.forwardSpeed, m_config.actions[actionIndex]);
     }
 
+    double getCoverage() const
+    {
+        return m_tiles ? m_tiles->getCoverage() : m_QL->getCoverage();
+    }
+
+    // learns again from transitions drawn from the replay buffer
+    void replay()
+    {
+        m_replay.sample(m_config.replayUpdates, m_config.replayBeta, m_replayRng, m_replaySlots, m_replayWeights);
+        m_replayStates.clear();
+        for (size_t i = 0; i < m_replaySlots.size(); i++)
+        {
+            const ReplayTransition & t = m_replay.get(m_replaySlots[i]);
+            double tdError = m_QL->replayValue((size_t)t.state, t.action, t.reward, (size_t)t.nextState, m_replayWeights[i]);
+            m_replay.updatePriority(m_replaySlots[i], tdError);
+            m_replayStates.push_back((size_t)t.state);
+        }
+
+        // policies are refreshed once per distinct state, as in updateBatch
+        std::sort(m_replayStates.begin(), m_replayStates.end());
+        m_replayStates.erase(std::unique(m_replayStates.begin(), m_replayStates.end()), m_replayStates.end());
+        for (size_t s : m_replayStates) { m_QL->updatePolicy(s); }
+    }
+
+    // hands the batch's transitions to the dataset
+    void recordTransitions(double reward)
+    {
+        for (size_t i = 0; i < m_states.size(); i++)
+        {
+            m_dataset.record(m_batchSteps[i], m_batchRobots[i], m_states[i], m_actions[i], reward, m_nextStates[i],
+                             m_datasetTerminal[i] != 0, m_datasetObs.data() + i * m_datasetFeatures, m_datasetNextObs.data() + i * m_datasetFeatures);
+        }
+    }
+
+    // the config values a checkpoint can only be resumed with, in the order written
+    std::vector<size_t> checkpointShape() const
+    {
+        return { m_config.numRobots, m_config.numPucks, m_config.numThreads, m_config.batchSize, m_config.numStates, m_config.numActions, m_config.replayCapacity,
+                 m_config.controlSkip };
+    }
+
+    // writes everything the run needs to carry on from this step
+    // the state is copied here and the copy is written on the checkpoint thread
+    void saveCheckpoint(const std::string & filename)
+    {
+        m_checkpointWriter.wait();
+
+        auto out = std::make_shared<CheckpointWriter>();
+        out->writeSizes(checkpointShape());
+        out->write((uint64_t)m_simulationSteps);
+        out->write((uint64_t)m_formations);
+        out->write((uint64_t)m_stepsUntilRLUpdate);
+        out->write(m_previousEval);
+        out->write(m_simulationTime);
+        out->writeSizes(m_formationCompleteTimes);
+
+        for (auto & rng : m_rngs) { out->writeRNG(rng); }
+        out->writeRNG(m_worldRng);
+        out->writeRNG(m_sim->getRNG());
+        out->writeRNG(m_replayRng);
+        m_replay.write(*out);
+        ExperimentCheckpoint::WriteWorld(*out, *m_sim->getWorld());
+
+        // each robot's held action and pending transition
+        out->writeSizes(m_heldActions);
+        out->writeArray(m_hasPending);
+        out->writeSizes(m_pendingStates);
+        out->writeSizes(m_pendingSteps);
+        out->writeArray(m_pendingActive);
+        out->writeArray(m_pendingObs);
+
+        // the batch still to be learned from
+        out->writeSizes(m_batchRobots);
+        out->writeSizes(m_batchSteps);
+        out->writeSizes(m_states);
+        out->writeSizes(m_actions);
+        out->writeSizes(m_nextStates);
+        out->writeArray(m_activeStates);
+        out->writeArray(m_activeNextStates);
+        out->writeArray(m_datasetObs);
+        out->writeArray(m_datasetNextObs);
+        out->writeArray(m_datasetTerminal);
+
+        // the plot and dataset are cut back to these lengths on resume, dropping what was written after the checkpoint
+        out->write((uint64_t)(m_metrics.isOpen() ? m_metrics.bytesWritten() : 0));
+        out->write((uint64_t)(m_dataset.isOpen() ? m_dataset.bytesWritten() : 0));
+
+        bool isTable = m_QL != nullptr;
+        auto table = isTable ? m_QL->snapshot() : m_tiles->snapshot();
+        m_checkpointWriter.submit([out, table, isTable, filename]
+        {
+            if (isTable) { QLearning::FinishSnapshot(*table); }
+            out->write((uint64_t)table->size());
+            out->writeBytes(table->data(), table->size());
+            ExperimentCheckpoint::Write(*out, filename);
+        });
+    }
+
+    // carries on from a checkpoint written by saveCheckpoint, which must come
+    // from a run with the same config. the world is rebuilt from the config
+    // and then overwritten with the checkpoint's. returns the lengths the plot
+    // and dataset files had reached, where the resumed run carries on writing them
+    std::pair<uint64_t, uint64_t> loadCheckpoint(const std::string & filename)
+    {
+        CheckpointReader in(filename);
+        if (!in.good())
+        {
+            std::cerr << "Experiment checkpoint is truncated or corrupt: " << filename << "\n";
+            exit(-1);
+        }
+
+        if (in.readSizes() != checkpointShape())
+        {
+            std::cerr << "Experiment checkpoint was written with different robots, pucks, threads, batch size, states or actions: " << filename << "\n";
+            exit(-1);
+        }
+
+        m_simulationSteps       = (size_t)in.read<uint64_t>();
+        m_formations            = (size_t)in.read<uint64_t>();
+        m_stepsUntilRLUpdate    = (size_t)in.read<uint64_t>();
+        m_previousEval          = in.read<double>();
+        m_simulationTime        = in.read<double>();
+        m_formationCompleteTimes = in.readSizes();
+
+        for (auto & rng : m_rngs) { in.readRNG(rng); }
+        in.readRNG(m_worldRng);
+        in.readRNG(m_sim->getRNG());
+        in.readRNG(m_replayRng);
+        bool replayMatches = m_replay.read(in);
+        bool worldMatches = ExperimentCheckpoint::ReadWorld(in, *m_sim->getWorld());
+        m_evalTracker = Eval::PuckThresholdTracker(m_sim->getWorld(), m_config.occ.thresholds[0], m_config.occ.thresholds[1]);
+
+        m_heldActions   = in.readSizes();
+        m_hasPending    = in.readArray<uint8_t>();
+        m_pendingStates = in.readSizes();
+        m_pendingSteps  = in.readSizes();
+        m_pendingActive = in.readArray<uint32_t>();
+        m_pendingObs    = in.readArray<double>();
+
+        m_batchRobots = in.readSizes();
+        m_batchSteps  = in.readSizes();
+        m_states      = in.readSizes();
+        m_actions     = in.readSizes();
+        m_nextStates  = in.readSizes();
+        m_activeStates     = in.readArray<uint32_t>();
+        m_activeNextStates = in.readArray<uint32_t>();
+        m_datasetObs       = in.readArray<double>();
+        m_datasetNextObs   = in.readArray<double>();
+        m_datasetTerminal  = in.readArray<uint8_t>();
+
+        uint64_t plotBytes = in.read<uint64_t>();
+        uint64_t datasetBytes = in.read<uint64_t>();
+        size_t tableSize = (size_t)in.read<uint64_t>();
+        const uint8_t * table = in.readBytes(tableSize);
+        size_t numRobots = m_sim->getWorld()->getEntities("robot").size();
+        if (!worldMatches || !replayMatches || !in.good() || m_states.size() != m_actions.size() || m_states.size() != m_nextStates.size()
+            || m_heldActions.size() != numRobots || m_hasPending.size() != numRobots)
+        {
+            std::cerr << "Experiment checkpoint does not match this experiment: " << filename << "\n";
+            exit(-1);
+        }
+        if (m_tiles) { m_tiles->loadBinary(table, tableSize, filename); }
+        else         { m_QL->loadBinary(table, tableSize, filename); }
+
+        m_resumedStep = m_simulationSteps;
+        std::cout << "Resumed from " << filename << " at step " << m_simulationSteps << "\n";
+        return { plotBytes, datasetBytes };
+    }
+
 public:
 
-    RLExperiment(const RLExperimentConfig & config)
+    // sharedQ is a table other experiments are learning into at the same time,
+    // in which case only the experiment told to save checkpoints writes them
+    RLExperiment(const RLExperimentConfig & config, std::shared_ptr<QLearning> sharedQ = nullptr, bool saveCheckpoints = true)
         : m_config(config)
+        , m_QL(sharedQ)
+        , m_sharedQ(sharedQ != nullptr)
+        , m_saveCheckpoints(saveCheckpoints)
     {
-        m_QL = QLearning(m_config.numStates, m_config.numActions, m_config.alpha, m_config.gamma, m_config.initialQ);
+        if (m_config.learner == "tiles")
+        {
+            m_tiles = std::make_shared<TileCodedQ>(m_config.tileFeatures, m_config.numTilings, m_config.tilesPerFeature, m_config.tileRows,
+                                                   m_config.numActions, m_config.alpha, m_config.gamma, m_config.initialQ);
+
+            // the tile coder learns alone, without the table's sharing, sparse rows or replay by state
+            if (m_QL || !m_config.sharedTable.empty() || m_config.sparseRows || m_config.replayCapacity)
+            {
+                std::cerr << "learner tiles does not support hogwildWorlds, sharedTable, sparseRows or replay\n";
+                exit(-1);
+            }
 
-        if (m_config.loadQ)
+            if (m_config.loadQ)
+            {
+                m_tiles->load(m_config.loadQFile);
+            }
+        }
+        else if (m_config.learner != "table")
         {
-            m_QL.load(m_config.loadQFile);
+            std::cerr << "Unknown learner, expected table or tiles: " << m_config.learner << "\n";
+            exit(-1);
+        }
+        else if (!m_QL)
+        {
+            m_QL = std::make_shared<QLearning>(m_config.numStates, m_config.numActions, m_config.alpha, m_config.gamma, m_config.initialQ, m_config.sparseRows);
+
+            if (m_config.loadQ)
+            {
+                m_QL->load(m_config.loadQFile);
+            }
+
+            if (!m_config.sharedTable.empty())
+            {
+                m_QL->attachShared(m_config.sharedTable);
+                m_sharedQ = true;
+            }
         }
 
         if (m_config.writePlotSkip)
         {
-            m_fout = std::ofstream(m_config.plotFile);
+            m_stepSeries      = m_metrics.addSeries("step");
+            m_evalSeries      = m_metrics.addSeries("eval");
+            m_formationSeries = m_metrics.addSeries("formations");
+            m_coverageSeries  = m_metrics.addSeries("coverage");
+        }
+
+        m_pool = std::make_shared<ThreadPool>(m_config.numThreads);
+        for (size_t t = 0; t < m_pool->size(); t++)
+        {
+            m_rngs.push_back(std::mt19937((unsigned)(m_config.seed * m_pool->size() + t)));
         }
+        m_worldRng.seed((unsigned)m_config.seed);
+        m_replayRng.seed((unsigned)(m_config.seed * m_pool->size() + m_pool->size()));
+        m_replay = ReplayBuffer(m_config.replayCapacity, m_config.replayAlpha);
 
         resetSimulator();
         m_stepsUntilRLUpdate = m_config.batchSize;
+
+        // a checkpoint holds one experiment's view of the table, which a table
+        // shared with other worlds or processes cannot be restored to
+        if (m_sharedQ && (m_config.checkpointSkip || m_config.resume))
+        {
+            std::cerr << "Experiment checkpoints are not supported with hogwildWorlds or sharedTable\n";
+            exit(-1);
+        }
+
+        // replayed updates are not written to be safe against other threads
+        if (m_sharedQ && m_config.replayCapacity)
+        {
+            std::cerr << "Replay is not supported with hogwildWorlds or sharedTable\n";
+            exit(-1);
+        }
+
+        std::pair<uint64_t, uint64_t> resumeBytes = { 0, 0 };
+        if (m_config.resume && AtomicFile::Exists(m_config.resumeFile))
+        {
+            resumeBytes = loadCheckpoint(m_config.resumeFile);
+        }
+        else if (m_config.resume && AtomicFile::Exists(AtomicFile::TempName(m_config.resumeFile)))
+        {
+            // the checkpoint is only ever replaced in one rename, so this is a
+            // first checkpoint that was stopped before it was complete
+            std::cerr << "Warning: no checkpoint to resume from, only the unfinished " << AtomicFile::TempName(m_config.resumeFile) << ", starting a new run\n";
+        }
+
+        if (m_config.writePlotSkip)
+        {
+            // a resumed run that cannot carry on its plot would no longer match an uninterrupted one
+            if (!m_metrics.open(m_config.plotFile, m_config.plotFormat == "binary" ? MetricsWriter::Binary : MetricsWriter::Text, 4096, resumeBytes.first) && resumeBytes.first)
+            {
+                exit(-1);
+            }
+        }
+
+        auto & robots = m_sim->getWorld()->getEntities("robot");
+        if (m_config.transitionChunkRows && !robots.empty())
+        {
+            const SensorLayout & layout = SensorTools::GetLayout(robots[0]);
+            std::vector<std::string> features;
+            for (size_t f = 0; f < layout.size(); f++) { features.push_back(layout.name(f)); }
+
+            m_datasetFeatures = layout.size();
+            if (!m_dataset.open(m_config.transitionFile, features, m_config.transitionChunkRows, resumeBytes.second) && resumeBytes.second)
+            {
+                exit(-1);
+            }
+        }
     }
     
     void doSimulationStep()
     {
-        if (m_config.writePlotSkip && m_simulationSteps % m_config.writePlotSkip == 0)
+        // before this step's plot row, which a resumed run writes itself
+        if (m_config.checkpointSkip && m_simulationSteps % m_config.checkpointSkip == 0 && m_simulationSteps != m_resumedStep)
+        {
+            saveCheckpoint(m_config.checkpointFile);
+        }
+
+        if (m_config.writePlotSkip && m_simulationSteps % m_config.writePlotSkip == 0 && m_metrics.isOpen())
         {
-            m_fout << m_simulationSteps << " " << m_previousEval << "\n";
-            m_fout.flush();
+            m_metrics.set(m_stepSeries, (double)m_simulationSteps);
+            m_metrics.set(m_evalSeries, m_previousEval);
+            m_metrics.set(m_formationSeries, (double)m_formations);
+            m_metrics.set(m_coverageSeries, getCoverage());
+            m_metrics.commit();
         }
         
-        if (m_config.saveQSkip && m_simulationSteps % m_config.saveQSkip == 0)
+        if (m_saveCheckpoints && m_config.saveQSkip && m_simulationSteps % m_config.saveQSkip == 0)
         {
-            m_QL.save(m_config.saveQFile);
+            if (m_tiles) { m_tiles->saveAsync(m_config.saveQFile, m_checkpointWriter); }
+            else         { m_QL->saveAsync(m_config.saveQFile, m_checkpointWriter); }
         }
 
         ++m_simulationSteps;
@@ -221,49 +667,134 @@ public:
             std::cout << "Simulation Step: " << m_simulationSteps << "\n";
         }
 
-        SensorReading reading;
+        auto & robots = m_sim->getWorld()->getEntities("robot");
+        size_t numActive = m_tiles ? m_tiles->activeCount() : 0;
+        size_t numFeatures = m_dataset.isOpen() ? m_datasetFeatures : 0;
+        m_pendingStates.resize(robots.size());
+        m_pendingSteps.resize(robots.size());
+        m_pendingActive.resize(robots.size() * numActive);
+        m_pendingObs.resize(robots.size() * numFeatures);
+        m_observations.resize(robots.size());
 
-        // control robots that have controllers
-        for (auto robot : m_sim->getWorld()->getEntities("robot"))
+        m_deciding.clear();
+        for (size_t r = 0; r < robots.size(); r++)
         {
-            // record the robot sensor state into the batch
-            SensorTools::ReadSensorArray(robot, m_sim->getWorld(), reading);
-            m_states.push_back(m_config.hashFunction(reading));
+            if (ControlRate::Decides(m_simulationSteps, r, m_config.controlSkip)) { m_deciding.push_back(r); }
+        }
+        m_decisionStates.resize(m_deciding.size());
 
-            // get the action that should be done for this entity
-            EntityAction action;
+        // control robots in parallel: sensors only read the world and actions only
+        // write the robot's own CSteer, so each thread handles a contiguous chunk of
+        // the deciding robots and writes its results into those robots' slots
+        m_pool->parallelFor(m_deciding.size(), [&](size_t begin, size_t end, size_t thread)
+        {
+            auto & rng = m_rngs[thread];
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
 
-            // epsilon-greedy action selection
-            if ((rand() / (double)RAND_MAX) < m_config.epsilon)
+            // record the robot sensor states as their pending transitions
+            // these readings were cached by the next state pass of the previous step
+            for (size_t d = begin; d < end; d++)
             {
-                action = getAction(rand() % 4);
+                size_t r = m_deciding[d];
+                m_observations[d] = SensorTools::ReadObservation(robots[r], m_sim->getWorld()).data();
+                std::copy(m_observations[d], m_observations[d] + numFeatures, m_pendingObs.data() + r * numFeatures);
+                if (m_tiles) { m_tiles->encode(m_observations[d], m_pendingActive.data() + r * numActive); }
             }
-            else
+            if (!m_tiles) { m_hasher->hashBatch(&m_observations[begin], end - begin, &m_decisionStates[begin]); }
+
+            for (size_t d = begin; d < end; d++)
             {
-                action = getAction(m_QL.selectActionFromPolicy(m_config.hashFunction(reading)));
-                // action = EntityControllers::OrbitalConstruction(robot, m_sim->getWorld(), reading, m_config.occ);
-            }
+                size_t r = m_deciding[d];
+                Entity robot = robots[r];
+                size_t state = m_decisionStates[d];
+
+                // get the action that should be done for this entity
+                EntityAction action;
+
+                // epsilon-greedy action selection
+                if (uniform(rng) < m_config.epsilon)
+                {
+                    action = getAction(rng() % m_config.actions.size());
+                }
+                else
+                {
+                    action = getAction(m_tiles ? m_tiles->selectActionFromPolicy(m_pendingActive.data() + r * numActive, rng)
+                                               : m_QL->selectActionFromPolicy(state, rng));
+                    // action = EntityControllers::OrbitalConstruction(robot, m_sim->getWorld(), m_observations[r], OrbitalConstructionFeatures(SensorTools::GetLayout(robot)), m_config.occ);
+                }
 
-            // record the action that the robot did into the batch
-            m_actions.push_back(getActionIndex(action));
-            m_robotsActed.push_back(robot);
+                // record the action that the robot did as its pending transition
+                m_pendingStates[r] = state;
+                m_pendingSteps[r]  = m_simulationSteps;
+                m_heldActions[r]   = getActionIndex(action);
+                m_hasPending[r]    = 1;
 
-            // have the action apply its effects to the entity
-            action.doAction(robot, m_config.simTimeStep);
+                // have the action apply its effects to the entity
+                action.doAction(robot, m_config.simTimeStep);
+            }
+        });
+
+        // the other robots carry on with the action they last chose
+        for (size_t r = 0; m_config.controlSkip > 1 && r < robots.size(); r++)
+        {
+            if (m_heldActions[r] != NoAction && !ControlRate::Decides(m_simulationSteps, r, m_config.controlSkip))
+            {
+                getAction(m_heldActions[r]).doAction(robots[r], m_config.simTimeStep);
+            }
         }
 
         // call the world physics simulation update
         // parameter = how much sim time should pass (default 1.0)
         m_sim->update(m_config.simTimeStep);
+        m_evalTracker.update(m_sim->getMovedEntities());
 
-        // record the robot next states to the batch
-        for (auto & robot : m_sim->getWorld()->getEntities("robot"))
+        // a formation resets the world after this step, ending the episode and
+        // with it every robot's pending transition
+        bool formed = m_config.resetEval && (m_evalTracker.value() > m_config.resetEval);
+
+        m_completing.clear();
+        for (size_t r = 0; r < robots.size(); r++)
         {
-            // record the robot sensor state into the batch
-            SensorTools::ReadSensorArray(robot, m_sim->getWorld(), reading);
-            m_nextStates.push_back(m_config.hashFunction(reading));
+            if (m_hasPending[r] && (formed || ControlRate::Decides(m_simulationSteps + 1, r, m_config.controlSkip))) { m_completing.push_back(r); }
         }
 
+        size_t batchStart = m_states.size();
+        size_t batchEnd = batchStart + m_completing.size();
+        m_batchRobots.resize(batchEnd);
+        m_batchSteps.resize(batchEnd);
+        m_states.resize(batchEnd);
+        m_actions.resize(batchEnd);
+        m_nextStates.resize(batchEnd);
+        m_activeStates.resize(batchEnd * numActive);
+        m_activeNextStates.resize(batchEnd * numActive);
+        m_datasetObs.resize(batchEnd * numFeatures);
+        m_datasetNextObs.resize(batchEnd * numFeatures);
+        if (m_dataset.isOpen())
+        {
+            m_datasetTerminal.resize(batchEnd, formed ? 1 : 0);
+        }
+
+        // record the completing robots' transitions and next states to the batch
+        m_pool->parallelFor(m_completing.size(), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t c = begin; c < end; c++)
+            {
+                size_t r = m_completing[c], i = batchStart + c;
+                m_observations[c] = SensorTools::ReadObservation(robots[r], m_sim->getWorld()).data();
+                std::copy(m_observations[c], m_observations[c] + numFeatures, m_datasetNextObs.data() + i * numFeatures);
+                std::copy(m_pendingObs.data() + r * numFeatures, m_pendingObs.data() + (r + 1) * numFeatures, m_datasetObs.data() + i * numFeatures);
+                std::copy(m_pendingActive.data() + r * numActive, m_pendingActive.data() + (r + 1) * numActive, m_activeStates.data() + i * numActive);
+
+                m_batchRobots[i] = r;
+                m_batchSteps[i]  = m_pendingSteps[r];
+                m_states[i]      = m_pendingStates[r];
+                m_actions[i]     = m_heldActions[r];
+                m_hasPending[r]  = 0;
+            }
+            if (m_tiles) { m_tiles->encodeBatch(&m_observations[begin], end - begin, m_activeNextStates.data() + (batchStart + begin) * numActive); }
+            else         { m_hasher->hashBatch(&m_observations[begin], end - begin, &m_nextStates[batchStart + begin]); }
+        });
+
         if (m_states.size() != m_actions.size() || m_states.size() != m_nextStates.size())
         {
             std::cout << "Warning: Batch Size Mismatch: S " << m_states.size() << " A " << m_actions.size() << " NS " << m_nextStates.size() << "\n";
@@ -273,17 +804,38 @@ public:
         if (--m_stepsUntilRLUpdate == 0)
         {
             // TODO: calculate the reward
-            double eval = Eval::PuckAvgThresholdDiff(m_sim->getWorld(), m_config.occ.thresholds[0], m_config.occ.thresholds[1]);
+            double eval = m_evalTracker.value();
             double reward = eval - m_previousEval;
 
             if (reward <= 0) reward -= 1;
 
+            if (m_dataset.isOpen())
+            {
+                recordTransitions(reward);
+            }
+
             if (m_config.qLearning)
             {
+                if (m_tiles)
+                {
+                    m_tiles->updateBatch(m_activeStates.data(), m_actions.data(), m_activeNextStates.data(), m_actions.size(), reward);
+                }
+                else if (m_sharedQ)
+                {
+                    m_QL->updateBatchShared(m_states.data(), m_actions.data(), m_nextStates.data(), m_states.size(), reward, m_qStats);
+
+                    // other worlds and processes plot and save the counts, so keep them current
+                    m_QL->mergeStats(m_qStats);
+                    m_qStats.resetCounts();
+                }
+                else
+                {
+                    m_QL->updateBatch(m_states.data(), m_actions.data(), m_nextStates.data(), m_states.size(), reward);
+                }
+
                 for (size_t i = 0; i < m_states.size(); i++)
                 {
-                    m_QL.updateValue(m_states[i], m_actions[i], reward, m_nextStates[i]);
-                    m_QL.updatePolicy(m_states[i]);
+                    m_replay.add(m_states[i], m_actions[i], reward, m_nextStates[i]);
                 }
             }
 
@@ -293,16 +845,37 @@ public:
             m_states.clear();
             m_actions.clear();
             m_nextStates.clear();
-            m_robotsActed.clear();
+            m_activeStates.clear();
+            m_activeNextStates.clear();
+            m_datasetObs.clear();
+            m_datasetNextObs.clear();
+            m_datasetTerminal.clear();
+            m_batchRobots.clear();
+            m_batchSteps.clear();
             m_stepsUntilRLUpdate = m_config.batchSize;
         }
+
+        if (m_config.qLearning && m_replay.size() > 0)
+        {
+            replay();
+        }
+
+        // the evaluation is current after every step, so a formation is
+        // noticed on the step it completes rather than at the next render
+        if (formed)
+        {
+            m_formations += 1;
+            m_formationCompleteTimes.push_back(m_simulationSteps);
+            resetSimulator();
+        }
     }
 
-    void printResults()
+    // suffix is added to the result file names, to tell hogwild worlds apart
+    void printResults(const std::string & suffix = "")
     {
         // prints out the number of formations completed
         std::stringstream ss;
-        ss << "gnuplot/results_form_" << m_config.numRobots << "_" << m_config.maxTimeSteps << ".txt";
+        ss << m_config.outputDir << "/results_form_" << m_config.numRobots << "_" << m_config.maxTimeSteps << suffix << ".txt";
         std::cout << "Printing Results to: " << ss.str() << "\n";
 
         std::ofstream fout(ss.str());
@@ -310,7 +883,7 @@ public:
 
         // prints out the number of  completed
         std::stringstream ss2;
-        ss2 << "gnuplot/results_form_over_time_" << m_config.numRobots << "_" << m_config.maxTimeSteps << ".txt";
+        ss2 << m_config.outputDir << "/results_form_over_time_" << m_config.numRobots << "_" << m_config.maxTimeSteps << suffix << ".txt";
         std::cout << "Printing Results to: " << ss2.str() << "\n";
 
 
@@ -323,15 +896,36 @@ public:
 
     }
 
+    RLRunSummary getSummary() const
+    {
+        RLRunSummary summary;
+        summary.formations      = m_formations;
+        summary.firstFormation  = m_formationCompleteTimes.empty() ? m_simulationSteps : m_formationCompleteTimes[0];
+        summary.steps           = m_simulationSteps;
+        summary.coverage        = getCoverage();
+        summary.finalEval       = m_evalTracker.value();
+        summary.stepsPerSecond  = m_simulationTime > 0 ? m_simulationSteps * 1000 / m_simulationTime : 0;
+        return summary;
+    }
+
+    // null when the experiment learns with tile coding
+    std::shared_ptr<QLearning> getQLearning() const
+    {
+        return m_QL;
+    }
+
     void run()
     {
         bool running = true;
         while (running)
         {
-            double eval = Eval::PuckAvgThresholdDiff(m_sim->getWorld(), m_config.occ.thresholds[0], m_config.occ.thresholds[1]);
-            
+            // steps are run in chunks ending on multiples of renderSteps, so a
+            // resumed run renders and stops on the same steps as the original
+            size_t chunk = (size_t)m_config.renderSteps;
+            if (chunk) { chunk -= m_simulationSteps % chunk; }
+
             m_simTimer.start();
-            for (size_t i = 0; i < m_config.renderSteps; i++)
+            for (size_t i = 0; i < chunk; i++)
             {
                 if (m_config.maxTimeSteps > 0 && m_simulationSteps >= m_config.maxTimeSteps)
                 {
@@ -348,36 +942,251 @@ public:
                 m_status = std::stringstream();
                 m_status << "Sim Steps:  " << m_simulationSteps << "\n";
                 m_status << "Sim / Sec:  " << m_simulationSteps * 1000 / m_simulationTime << "\n";
-                m_status << "QO Coverage: " << m_QL.getCoverage() << " of " << m_QL.size() << "\n";
-                m_status << "Puck Eval:  " << eval << "\n";
+                m_status << "QO Coverage: " << getCoverage() << " of " << (m_tiles ? m_tiles->size() : m_QL->size()) << "\n";
+                if (m_config.sparseRows)
+                {
+                    QTableSparseStats sparse = m_QL->getSparseStats();
+                    m_status << "Sparse Rows: " << sparse.used << " of " << sparse.slots << ", " << sparse.drops << " drops\n";
+                }
+                if (m_config.replayCapacity)
+                {
+                    m_status << "Replay:     " << m_replay.size() << " of " << m_replay.capacity() << (m_replay.prioritized() ? " prioritized\n" : "\n");
+                }
+                m_status << "Puck Eval:  " << m_evalTracker.value() << "\n";
                 m_status << "Formations: " << m_formations << "\n";
+                if (m_QL && m_QL->isShared())
+                {
+                    QTableSharedStats shared = m_QL->getSharedStats();
+                    m_status << "Shared:     " << shared.attaches - shared.detaches << " attached, " << shared.merges << " merges\n";
+                }
                 m_gui->setStatus(m_status.str());
 
                 // draw gui
                 m_gui->update();
             }
-
-            if (m_config.resetEval && (eval > m_config.resetEval))
-            {
-                m_formations += 1;
-                m_formationCompleteTimes.push_back(m_simulationSteps);
-                resetSimulator();
-            }
         }
+
+        // a finished run can be carried on to more steps later, as cwaggle_sweep
+        // does with the runs it keeps
+        if (m_config.checkpointSkip) { saveCheckpoint(m_config.checkpointFile); }
+
+        m_metrics.flush();
+        m_dataset.sync();
+        m_checkpointWriter.wait();
     }
 };
 
 
 namespace RLExperiments
 {
-    void MainRLExperiment()
+    // Hogwild: every world runs its own experiment on its own thread, all of
+    // them learning into one shared table without locks. Each world runs the
+    // configured number of steps, so the table sees hogwildWorlds times the
+    // experience in roughly the wall time of one run
+    void HogwildRLExperiment(const RLExperimentConfig & config)
+    {
+        auto table = std::make_shared<QLearning>(config.numStates, config.numActions, config.alpha, config.gamma, config.initialQ, config.sparseRows);
+        if (config.loadQ) { table->load(config.loadQFile); }
+        if (!config.sharedTable.empty()) { table->attachShared(config.sharedTable); }
+
+        std::vector<std::shared_ptr<RLExperiment>> experiments(config.hogwildWorlds);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < config.hogwildWorlds; w++)
+        {
+            threads.emplace_back([&, w]
+            {
+                // each world is headless and single threaded, with its own seed,
+                // and only the first world writes the plot and the checkpoints
+                RLExperimentConfig worldConfig = config;
+                worldConfig.gui = 0;
+                worldConfig.numThreads = 1;
+                worldConfig.seed = config.seed * config.hogwildWorlds + w;
+                if (w > 0) { worldConfig.writePlotSkip = 0; }
+                worldConfig.transitionFile = config.transitionFile + "_w" + std::to_string(w);
+
+                experiments[w] = std::make_shared<RLExperiment>(worldConfig, table, w == 0);
+                experiments[w]->run();
+            });
+        }
+        for (auto & thread : threads) { thread.join(); }
+
+        // the worlds merged their update counters into the table after every batch
+        RLRunSummary total;
+        total.firstFormation = (size_t)-1;
+        for (size_t w = 0; w < experiments.size(); w++)
+        {
+            experiments[w]->printResults("_w" + std::to_string(w));
+
+            RLRunSummary summary = experiments[w]->getSummary();
+            total.formations     += summary.formations;
+            total.firstFormation  = std::min(total.firstFormation, summary.firstFormation);
+            total.steps          += summary.steps;
+            total.finalEval      += summary.finalEval / experiments.size();
+            total.stepsPerSecond += summary.stepsPerSecond;
+        }
+        total.coverage = table->getCoverage();
+
+        std::cout << "Printing Results to: " << config.outputDir << "/summary.txt\n";
+        total.write(config.outputDir + "/summary.txt");
+    }
+
+    // Greedy evaluation of a saved policy, with no exploration and no learning
+    // Each episode builds a new world seeded from the config seed and its
+    // episode number, and runs until the pucks form or evalMaxSteps pass. The
+    // deciding robots' observations are hashed and their actions looked up
+    // together each step, at the training controlSkip. Episodes are handed to numThreads threads as they free up,
+    // and each depends only on its seed, so the results are the same for any
+    // number of threads
+    void EvaluatePolicy(const RLExperimentConfig & config)
+    {
+        size_t maxSteps = config.evalMaxSteps ? config.evalMaxSteps : config.maxTimeSteps;
+        if (!config.loadQ || maxSteps == 0)
+        {
+            std::cerr << "Evaluation needs a policy, set loadPolicy 1 <file>, and a step limit, set evaluate <episodes> <maxSteps>\n";
+            exit(-1);
+        }
+
+        std::shared_ptr<GreedyPolicy> policy;
+        if (config.learner == "tiles")
+        {
+            auto tiles = std::make_shared<TileCodedQ>(config.tileFeatures, config.numTilings, config.tilesPerFeature, config.tileRows,
+                                                      config.numActions, config.alpha, config.gamma, config.initialQ);
+            tiles->load(config.loadQFile);
+            policy = std::make_shared<GreedyPolicy>(tiles);
+        }
+        else if (config.learner == "table")
+        {
+            auto table = std::make_shared<QLearning>(config.numStates, config.numActions, config.alpha, config.gamma, config.initialQ, config.sparseRows);
+            table->load(config.loadQFile);
+            policy = std::make_shared<GreedyPolicy>(table);
+        }
+        else
+        {
+            std::cerr << "Unknown learner, expected table or tiles: " << config.learner << "\n";
+            exit(-1);
+        }
+
+        // every robot of the square world has the same sensors, so any one binds the policy
+        auto layoutWorld = ExampleWorlds::GetGetSquareWorld(config.width, config.height, 1, config.robotRadius, 0, config.puckRadius);
+        ExampleWorlds::AddRangeSensors(layoutWorld, "range", config.rangeRays, config.rangeFov, config.rangeMax);
+        policy->bind(SensorTools::GetLayout(layoutWorld->getEntities("robot")[0]), config.hashFunction, config.hashSpec);
+
+        std::vector<EvalEpisode> episodes(config.evalEpisodes);
+        std::atomic<size_t> nextEpisode(0);
+        Timer timer;
+        timer.start();
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < std::max<size_t>(config.numThreads, 1); t++)
+        {
+            threads.emplace_back([&]
+            {
+                const size_t NoAction = (size_t)-1;
+                std::vector<const double *> observations;
+                std::vector<size_t> deciding, actions, heldActions;
+                std::vector<uint32_t> active;
+
+                for (size_t e = nextEpisode++; e < episodes.size(); e = nextEpisode++)
+                {
+                    EvalEpisode & episode = episodes[e];
+                    episode.seed = config.seed * episodes.size() + e;
+                    std::mt19937 rng((unsigned)episode.seed);
+
+                    auto world = ExampleWorlds::GetGetSquareWorld(config.width, config.height, config.numRobots, config.robotRadius,
+                                                                  config.numPucks, config.puckRadius, rng);
+                    ExampleWorlds::AddRangeSensors(world, "range", config.rangeRays, config.rangeFov, config.rangeMax);
+                    Simulator sim(world);
+                    sim.getRNG().seed(rng());
+                    Eval::PuckThresholdTracker tracker(world, config.occ.thresholds[0], config.occ.thresholds[1]);
+
+                    auto & robots = world->getEntities("robot");
+                    actions.resize(robots.size());
+                    heldActions.assign(robots.size(), NoAction);
+
+                    while (!episode.formed && episode.steps < maxSteps)
+                    {
+                        deciding.clear();
+                        observations.clear();
+                        for (size_t r = 0; r < robots.size(); r++)
+                        {
+                            if (!ControlRate::Decides(episode.steps + 1, r, config.controlSkip)) { continue; }
+                            deciding.push_back(r);
+                            observations.push_back(SensorTools::ReadObservation(robots[r], world).data());
+                        }
+                        policy->selectBatch(observations.data(), deciding.size(), actions.data(), active, rng);
+                        for (size_t d = 0; d < deciding.size(); d++) { heldActions[deciding[d]] = actions[d]; }
+                        episode.decisions += deciding.size();
+
+                        for (size_t r = 0; r < robots.size(); r++)
+                        {
+                            if (heldActions[r] == NoAction) { continue; }
+                            EntityAction(config.occ.forwardSpeed, config.actions[heldActions[r]]).doAction(robots[r], config.simTimeStep);
+                        }
+
+                        sim.update(config.simTimeStep);
+                        tracker.update(sim.getMovedEntities());
+                        episode.steps++;
+                        episode.formed = config.resetEval && tracker.value() > config.resetEval;
+                    }
+                    episode.finalEval = tracker.value();
+                }
+            });
+        }
+        for (auto & thread : threads) { thread.join(); }
+
+        PolicyEvalSummary summary = PolicyEvalSummary::Compute(episodes, timer.getElapsedTimeInMilliSec() / 1000);
+        std::cout << "Evaluated " << config.loadQFile << " over " << summary.episodes << " episodes: "
+                  << summary.formations << " formed, formation time mean " << summary.formationMean << " median " << summary.formationMedian
+                  << " p90 " << summary.formationP90 << ", " << summary.stepsPerSecond << " steps/s\n";
+
+        std::string episodesFile = config.outputDir + "/evaluation_episodes.txt";
+        std::cout << "Printing Results to: " << episodesFile << "\n";
+        std::ofstream fout(episodesFile);
+        for (size_t e = 0; e < episodes.size(); e++)
+        {
+            fout << e << " " << episodes[e].seed << " " << episodes[e].formed << " " << episodes[e].steps << " " << episodes[e].finalEval << "\n";
+        }
+
+        std::cout << "Printing Results to: " << config.outputDir << "/summary.txt\n";
+        summary.write(config.outputDir + "/summary.txt");
+    }
+
+    void MainRLExperiment(const std::string & configFile = "rl_config.txt")
     {
         RLExperimentConfig config;
-        config.load("rl_config.txt");
+        config.load(configFile);
+
+        if (config.evalEpisodes)
+        {
+            EvaluatePolicy(config);
+            return;
+        }
+
+        if (config.hogwildWorlds > 1)
+        {
+            HogwildRLExperiment(config);
+            return;
+        }
 
         RLExperiment exp(config);
         exp.run();
         exp.printResults();
+
+        if (exp.getQLearning() && config.sparseRows)
+        {
+            QTableSparseStats sparse = exp.getQLearning()->getSparseStats();
+            std::cout << "Sparse table: " << sparse.used << " of " << sparse.slots << " rows used, " << sparse.drops << " updates dropped, "
+                      << "probe length mean " << sparse.meanProbe << " max " << sparse.maxProbe << "\n";
+        }
+
+        if (exp.getQLearning() && exp.getQLearning()->isShared())
+        {
+            QTableSharedStats shared = exp.getQLearning()->getSharedStats();
+            std::cout << "Shared table " << config.sharedTable << ": " << shared.attaches << " attaches, " << shared.detaches << " detaches, "
+                      << shared.merges << " merges, " << shared.updates << " updates, " << shared.visited << " visited\n";
+        }
+
+        std::cout << "Printing Results to: " << config.outputDir << "/summary.txt\n";
+        exp.getSummary().write(config.outputDir + "/summary.txt");
     }
 }
-
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <cstring>
+
+// One transition as kept for replay, 24 bytes so the ring stays compact
+struct ReplayTransition
+{
+    uint64_t state;
+    uint64_t nextState;
+    float    reward;
+    uint32_t action;
+};
+
+// A fixed-capacity ring of the most recent transitions, for replaying past
+// experience through the learner
+// Sampling is uniform, or prioritized by the size of each transition's last
+// TD error, so surprising transitions are replayed more often. Priorities
+// live in a sum tree beside the ring: each leaf is one slot's priority and
+// each parent the sum of its children, so sampling and updating a priority
+// are a walk from the root to a leaf. Memory is fixed by the capacity, at
+// 24 bytes per transition and, when prioritized, up to 32 more for the tree
+class ReplayBuffer
+{
+    std::vector<ReplayTransition>   m_ring;
+    std::vector<double>             m_tree;         // node i has children 2i and 2i+1, leaves start at m_leaves
+    size_t                          m_leaves = 0;   // capacity rounded up to a power of two
+    size_t                          m_next = 0;     // slot the next transition is written to
+    size_t                          m_size = 0;
+    double                          m_alpha = 0;    // priority = (|td| + MinPriority) ^ alpha, 0 samples uniformly
+    double                          m_maxPriority = 1;
+
+    static constexpr double MinPriority = 1e-4;     // keeps every transition some chance of being drawn
+
+    void setPriority(size_t slot, double priority)
+    {
+        size_t node = m_leaves + slot;
+        m_tree[node] = priority;
+        for (node /= 2; node >= 1; node /= 2)
+        {
+            // summed from the children rather than adjusted, so rounding never accumulates
+            m_tree[node] = m_tree[2 * node] + m_tree[2 * node + 1];
+        }
+    }
+
+    // the slot whose range of the cumulative priorities contains u
+    size_t findSlot(double u) const
+    {
+        size_t node = 1;
+        while (node < m_leaves)
+        {
+            double left = m_tree[2 * node];
+            if ((u < left && left > 0) || m_tree[2 * node + 1] <= 0) { node = 2 * node; }
+            else { u -= left; node = 2 * node + 1; }
+        }
+        return std::min(node - m_leaves, m_size - 1);
+    }
+
+public:
+
+    ReplayBuffer() {}
+
+    // alpha of 0 samples uniformly, larger values sample in proportion to TD error
+    ReplayBuffer(size_t capacity, double alpha)
+        : m_alpha(alpha)
+    {
+        m_ring.resize(capacity);
+        if (prioritized())
+        {
+            m_leaves = 1;
+            while (m_leaves < capacity) { m_leaves *= 2; }
+            m_tree.assign(2 * m_leaves, 0.0);
+        }
+    }
+
+    inline bool prioritized() const
+    {
+        return m_alpha > 0;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    size_t capacity() const
+    {
+        return m_ring.size();
+    }
+
+    // adds a transition, replacing the oldest once the buffer is full
+    // new transitions get the largest priority seen, so each is replayed soon
+    void add(size_t state, size_t action, double reward, size_t nextState)
+    {
+        if (m_ring.empty()) { return; }
+
+        m_ring[m_next] = { (uint64_t)state, (uint64_t)nextState, (float)reward, (uint32_t)action };
+        if (prioritized()) { setPriority(m_next, m_maxPriority); }
+        m_next = (m_next + 1) % m_ring.size();
+        m_size = std::min(m_size + 1, m_ring.size());
+    }
+
+    const ReplayTransition & get(size_t slot) const
+    {
+        return m_ring[slot];
+    }
+
+    // draws count slots, and the importance weight of each, which corrects
+    // the learning rate for prioritized sampling with exponent beta and is
+    // scaled so the largest weight of the batch is 1. uniform weights are all 1
+    // prioritized draws are stratified, one from each of count equal ranges
+    // of the cumulative priorities, which spreads a batch over the buffer
+    template <class RNG>
+    void sample(size_t count, double beta, RNG & rng, std::vector<size_t> & slots, std::vector<double> & weights) const
+    {
+        slots.resize(count);
+        weights.assign(count, 1.0);
+        if (m_size == 0) { slots.clear(); weights.clear(); return; }
+
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        if (!prioritized())
+        {
+            for (auto & slot : slots) { slot = rng() % m_size; }
+            return;
+        }
+
+        double total = m_tree[1];
+        double segment = total / count;
+        double maxWeight = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            slots[i] = findSlot(segment * (i + uniform(rng)));
+            double probability = m_tree[m_leaves + slots[i]] / total;
+            weights[i] = beta > 0 ? std::pow(m_size * probability, -beta) : 1.0;
+            maxWeight = std::max(maxWeight, weights[i]);
+        }
+        for (auto & w : weights) { w /= maxWeight; }
+    }
+
+    // sets a replayed slot's priority from the TD error its update just had
+    void updatePriority(size_t slot, double tdError)
+    {
+        if (!prioritized()) { return; }
+        double priority = std::pow(std::abs(tdError) + MinPriority, m_alpha);
+        m_maxPriority = std::max(m_maxPriority, priority);
+        setPriority(slot, priority);
+    }
+
+    // the ring and priorities, for experiment checkpoints
+    template <class Writer>
+    void write(Writer & out) const
+    {
+        out.write((uint64_t)m_next);
+        out.write((uint64_t)m_size);
+        out.write(m_maxPriority);
+        out.writeBytes(m_ring.data(), m_size * sizeof(ReplayTransition));
+        for (size_t slot = 0; prioritized() && slot < m_size; slot++) { out.write(m_tree[m_leaves + slot]); }
+    }
+
+    // restores a buffer written by write into one of the same capacity and
+    // alpha, returns false if the written buffer does not fit
+    template <class Reader>
+    bool read(Reader & in)
+    {
+        size_t next = (size_t)in.template read<uint64_t>();
+        size_t size = (size_t)in.template read<uint64_t>();
+        double maxPriority = in.template read<double>();
+        if (size > m_ring.size() || next >= std::max<size_t>(m_ring.size(), 1)) { return false; }
+
+        const uint8_t * ring = in.readBytes(size * sizeof(ReplayTransition));
+        if (!ring) { return false; }
+        memcpy(m_ring.data(), ring, size * sizeof(ReplayTransition));
+        m_next = next;
+        m_size = size;
+        m_maxPriority = maxPriority;
+
+        for (size_t slot = 0; prioritized() && slot < m_size; slot++) { setPriority(slot, in.template read<double>()); }
+        return in.good();
+    }
+};
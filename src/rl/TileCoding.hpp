@@ -0,0 +1,299 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cmath>
+
+#include "CWaggle.h"
+#include "AtomicFile.hpp"
+#include "QLearning.hpp"
+
+// One input of a tile coder: an observation feature and the range it is tiled over
+//
+//   tileFeature midNest 0 1
+struct TileFeatureSpec
+{
+    std::string name;
+    double      min = 0;
+    double      max = 1;
+
+    // parses the rest of a tileFeature line
+    static TileFeatureSpec Parse(const std::string & line)
+    {
+        std::stringstream ss(line);
+        TileFeatureSpec feature;
+        if (!(ss >> feature.name >> feature.min >> feature.max) || !(feature.max > feature.min))
+        {
+            std::cerr << "Invalid tileFeature, expected name min max with max above min: " << line << "\n";
+            exit(-1);
+        }
+        return feature;
+    }
+};
+
+namespace TileRow
+{
+    // dst += src over a padded row
+    inline void Add(float * dst, const float * src, size_t stride)
+    {
+    #ifdef CWAGGLE_QTABLE_SSE
+        for (size_t a = 0; a < stride; a += 4) { _mm_store_ps(dst + a, _mm_add_ps(_mm_load_ps(dst + a), _mm_load_ps(src + a))); }
+    #else
+        for (size_t a = 0; a < stride; a++) { dst[a] += src[a]; }
+    #endif
+    }
+}
+
+// Linear Q-learning over tile-coded observations
+// Each of numTilings tilings cuts the chosen features into tilesPerFeature
+// tiles per feature, every tiling offset from the others by a fraction of a
+// tile, so a state activates one tile per tiling and nearby states share most
+// of them. Tiles are hashed into a fixed number of weight rows, which bounds
+// memory whatever the number of features; colliding tiles share a row
+// Q(s, .) is the sum of the state's active rows, each row holding one weight
+// per action padded like a Q table row, so the values of every action come
+// out of numTilings vector adds. An update touches one weight in each active
+// row. A state here is the block of numTilings row indices from encode
+class TileCodedQ
+{
+    std::vector<TileFeatureSpec>    m_specs;
+    std::vector<size_t>             m_features;     // observation slot of each spec, set by bind
+    std::vector<double>             m_scale;        // tiles per unit of each feature
+    size_t                          m_numTilings = 0;
+    size_t                          m_tiles = 0;
+    size_t                          m_numActions = 0;
+    size_t                          m_stride = 0;
+    size_t                          m_numRows = 0;
+    size_t                          m_updates = 0;
+    size_t                          m_usedRows = 0;
+    double                          m_alpha = 0;    // step size of a whole update, split over the tilings
+    double                          m_gamma = 0;
+    double                          m_initialQ = 0;
+    uint64_t                        m_actionMask = 0;
+    AlignedVector<float>            m_w;
+    std::vector<char>               m_used;         // rows that have been updated
+
+    static const size_t MaxActions = 64;
+
+    inline float * row(size_t r)                { return m_w.data() + r * m_stride; }
+    inline const float * row(size_t r) const    { return m_w.data() + r * m_stride; }
+
+    // Q(s, .) into q, with the padding set so it never wins a max
+    inline void values(const uint32_t * active, float * q) const
+    {
+        std::fill(q, q + m_stride, 0.0f);
+        for (size_t t = 0; t < m_numTilings; t++) { TileRow::Add(q, row(active[t]), m_stride); }
+        std::fill(q + m_numActions, q + m_stride, std::numeric_limits<float>::lowest());
+    }
+
+    inline float value(const uint32_t * active, size_t a) const
+    {
+        float q = 0;
+        for (size_t t = 0; t < m_numTilings; t++) { q += row(active[t])[a]; }
+        return q;
+    }
+
+    inline float maxValue(const uint32_t * active) const
+    {
+        alignas(16) float q[MaxActions];
+        values(active, q);
+        return QRow::Max(q, m_stride);
+    }
+
+    // mixes a tiling and its tile coordinates into a row
+    inline uint32_t tileRow(uint64_t hash) const
+    {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return (uint32_t)(hash % m_numRows);
+    }
+
+public:
+
+    TileCodedQ() {}
+
+    TileCodedQ(const std::vector<TileFeatureSpec> & specs, size_t numTilings, size_t tilesPerFeature, size_t numRows,
+               size_t numActions, double alpha, double gamma, double initialQ)
+        : m_specs(specs)
+        , m_numTilings(std::max<size_t>(numTilings, 1))
+        , m_tiles(std::max<size_t>(tilesPerFeature, 1))
+        , m_numActions(numActions)
+        , m_numRows(std::max<size_t>(numRows, 1))
+        , m_alpha(alpha)
+        , m_gamma(gamma)
+        , m_initialQ(initialQ)
+    {
+        if (m_specs.empty() || numActions == 0 || numActions > MaxActions || m_numRows > std::numeric_limits<uint32_t>::max())
+        {
+            std::cerr << "Tile coding needs at least one tileFeature, 1 to " << MaxActions << " actions and fewer than 2^32 rows\n";
+            exit(-1);
+        }
+
+        for (auto & spec : m_specs) { m_scale.push_back(m_tiles / (spec.max - spec.min)); }
+        m_stride = (numActions + 3) / 4 * 4;
+        m_actionMask = numActions == 64 ? ~0ULL : (1ULL << numActions) - 1;
+
+        // every state's value starts at initialQ, shared evenly by its tilings
+        m_w.assign(m_numRows * m_stride, (float)(initialQ / m_numTilings));
+        m_used.assign(m_numRows, 0);
+    }
+
+    // resolves the feature names against the robots' sensor layout
+    void bind(const SensorLayout & layout)
+    {
+        m_features.clear();
+        for (auto & spec : m_specs) { m_features.push_back(SensorTools::RequireFeature(layout, spec.name)); }
+    }
+
+    // row indices per state
+    size_t activeCount() const
+    {
+        return m_numTilings;
+    }
+
+    // the active row of each tiling for an observation
+    // tiling t is shifted by t / numTilings of a tile times an odd number that
+    // differs per feature, so the tilings do not all line up along the diagonal
+    void encode(const double * obs, uint32_t * active) const
+    {
+        for (size_t t = 0; t < m_numTilings; t++)
+        {
+            uint64_t hash = (t + 1) * 0x9E3779B97F4A7C15ULL;
+            for (size_t f = 0; f < m_features.size(); f++)
+            {
+                double x = (obs[m_features[f]] - m_specs[f].min) * m_scale[f];
+                x = std::min(std::max(x, 0.0), (double)m_tiles);
+                int64_t coord = (int64_t)std::floor(x + (double)(t * (2 * f + 1) % m_numTilings) / m_numTilings);
+                hash = (hash ^ (uint64_t)coord) * 0x100000001B3ULL + f;
+            }
+            active[t] = tileRow(hash);
+        }
+    }
+
+    void encodeBatch(const double * const * obs, size_t count, uint32_t * active) const
+    {
+        for (size_t i = 0; i < count; i++) { encode(obs[i], active + i * m_numTilings); }
+    }
+
+    // greedy action with random tie breaking, safe to call from many threads at once
+    template <class RNG>
+    size_t selectActionFromPolicy(const uint32_t * active, RNG & rng) const
+    {
+        alignas(16) float q[MaxActions];
+        values(active, q);
+
+        uint64_t ties;
+        QRow::MaxTies(q, m_stride, ties);
+        ties &= m_actionMask;
+        if (!ties) { ties = m_actionMask; }
+
+        size_t choice = rng() % QRow::CountBits(ties);
+        while (choice--) { ties &= ties - 1; }
+        return QRow::LowestBit(ties);
+    }
+
+    // one Q-learning step on the weights of the active rows, returns the TD error
+    double updateValue(const uint32_t * s, size_t a, double r, const uint32_t * ns)
+    {
+        double tdError = r + m_gamma * maxValue(ns) - value(s, a);
+        float step = (float)(m_alpha * tdError / m_numTilings);
+        for (size_t t = 0; t < m_numTilings; t++)
+        {
+            row(s[t])[a] += step;
+            if (!m_used[s[t]]) { m_used[s[t]] = 1; m_usedRows++; }
+        }
+        m_updates++;
+        return tdError;
+    }
+
+    // applies a batch of samples that all received the same reward, in order,
+    // states and nextStates holding activeCount rows per sample
+    void updateBatch(const uint32_t * states, const size_t * actions, const uint32_t * nextStates, size_t count, double r)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            updateValue(states + i * m_numTilings, actions[i], r, nextStates + i * m_numTilings);
+        }
+    }
+
+    size_t numRows() const
+    {
+        return m_numRows;
+    }
+
+    size_t numUpdates() const
+    {
+        return m_updates;
+    }
+
+    // the weights of every row and action
+    size_t size() const
+    {
+        return m_numRows * m_numActions;
+    }
+
+    // the fraction of rows that have been updated
+    double getCoverage() const
+    {
+        return (double)m_usedRows / m_numRows;
+    }
+
+    // the weights and counters in a binary file of their own:
+    // "CWTILEQ1", uint64 tilings, tiles, rows, actions, stride, updates, then
+    // the padded weight rows as floats and one used byte per row
+    std::shared_ptr<std::vector<char>> snapshot() const
+    {
+        auto bytes = std::make_shared<std::vector<char>>();
+        auto put = [&](const void * data, size_t size) { bytes->insert(bytes->end(), (const char *)data, (const char *)data + size); };
+        uint64_t dims[6] = { m_numTilings, m_tiles, m_numRows, m_numActions, m_stride, m_updates };
+        put("CWTILEQ1", 8);
+        put(dims, sizeof(dims));
+        put(m_w.data(), m_w.size() * sizeof(float));
+        put(m_used.data(), m_used.size());
+        return bytes;
+    }
+
+    // loads a snapshot taken from a learner with the same tilings, rows and actions
+    void loadBinary(const uint8_t * data, size_t size, const std::string & filename)
+    {
+        uint64_t dims[6] = {};
+        bool valid = size >= 8 + sizeof(dims) && memcmp(data, "CWTILEQ1", 8) == 0;
+        if (valid) { memcpy(dims, data + 8, sizeof(dims)); }
+        valid = valid && dims[0] == m_numTilings && dims[1] == m_tiles && dims[2] == m_numRows && dims[3] == m_numActions && dims[4] == m_stride
+                      && size == 8 + sizeof(dims) + m_w.size() * sizeof(float) + m_used.size();
+        if (!valid)
+        {
+            std::cerr << "Tile coded weights are corrupt or from a different tileCoding or actions: " << filename << "\n";
+            exit(-1);
+        }
+
+        const uint8_t * w = data + 8 + sizeof(dims);
+        memcpy(m_w.data(), w, m_w.size() * sizeof(float));
+        memcpy(m_used.data(), w + m_w.size() * sizeof(float), m_used.size());
+        m_updates  = (size_t)dims[5];
+        m_usedRows = (size_t)std::count(m_used.begin(), m_used.end(), 1);
+    }
+
+    void load(const std::string & filename)
+    {
+        std::ifstream fin(filename, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        loadBinary((const uint8_t *)bytes.data(), bytes.size(), filename);
+    }
+
+    // snapshots the weights now and writes them on the worker thread, through
+    // a temporary file like the Q table checkpoints
+    void saveAsync(const std::string & filename, BackgroundWorker & worker) const
+    {
+        worker.wait();
+        auto bytes = snapshot();
+        worker.submit([bytes, filename]
+        {
+            AtomicFile::Write(filename, bytes->data(), bytes->size(), "tile coded weights");
+        });
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "AtomicFile.hpp"
+#include "BackgroundWorker.hpp"
+#include "MappedFile.hpp"
+#include "QLearning.hpp"
+
+// A chunk of recorded transitions, one column per field
+struct TransitionChunk
+{
+    size_t                  numFeatures = 0;
+    std::vector<uint64_t>   steps;              // the simulation step the transition was taken on
+    std::vector<uint32_t>   robots;             // the robot's index in the world
+    std::vector<uint64_t>   states;
+    std::vector<uint32_t>   actions;
+    std::vector<float>      rewards;
+    std::vector<uint64_t>   nextStates;
+    std::vector<uint8_t>    terminal;           // 1 if the world was reset after the step, ending its episode
+    std::vector<double>     observations;       // numFeatures raw sensor readings per transition
+    std::vector<double>     nextObservations;
+
+    size_t size() const
+    {
+        return steps.size();
+    }
+
+    void clear()
+    {
+        steps.clear();
+        robots.clear();
+        states.clear();
+        actions.clear();
+        rewards.clear();
+        nextStates.clear();
+        terminal.clear();
+        observations.clear();
+        nextObservations.clear();
+    }
+
+    const double * observation(size_t i) const
+    {
+        return observations.data() + i * numFeatures;
+    }
+
+    const double * nextObservation(size_t i) const
+    {
+        return nextObservations.data() + i * numFeatures;
+    }
+};
+
+// The column encodings of a transition dataset
+namespace TransitionCodec
+{
+    // 7 bits per byte, low bits first, the top bit set on every byte but the last
+    inline void PutVarint(std::vector<uint8_t> & out, uint64_t value)
+    {
+        while (value >= 0x80) { out.push_back((uint8_t)(value | 0x80)); value >>= 7; }
+        out.push_back((uint8_t)value);
+    }
+
+    inline bool GetVarint(const uint8_t *& p, const uint8_t * end, uint64_t & value)
+    {
+        value = 0;
+        for (size_t shift = 0; p < end && shift < 64; shift += 7)
+        {
+            uint8_t byte = *p++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) { return true; }
+        }
+        return false;
+    }
+
+    // the bits of a value XORed with those of the value before it, as one byte
+    // counting the leading and trailing zero bytes followed by the bytes
+    // between them. a repeated value takes one byte, and values that share
+    // their sign and exponent or end in zero bits, as sensor readings that are
+    // small counts or come from float grids do, take few more
+    inline void PutXor(std::vector<uint8_t> & out, uint64_t bits)
+    {
+        if (bits == 0) { out.push_back(0x80); return; }
+
+        size_t lead = 0, trail = 0;
+        while (((bits >> (8 * (7 - lead))) & 0xFF) == 0) { lead++; }
+        while (((bits >> (8 * trail)) & 0xFF) == 0)      { trail++; }
+        out.push_back((uint8_t)(lead << 4 | trail));
+        for (size_t b = trail; b < 8 - lead; b++) { out.push_back((uint8_t)(bits >> (8 * b))); }
+    }
+
+    inline bool GetXor(const uint8_t *& p, const uint8_t * end, uint64_t & bits)
+    {
+        bits = 0;
+        if (p >= end) { return false; }
+
+        size_t lead = *p >> 4, trail = *p & 0x0F;
+        p++;
+        if (lead == 8 && trail == 0) { return true; }
+        if (lead + trail >= 8 || (size_t)(end - p) < 8 - lead - trail) { return false; }
+        for (size_t b = trail; b < 8 - lead; b++) { bits |= (uint64_t)*p++ << (8 * b); }
+        return true;
+    }
+
+    inline uint64_t Bits(double value)  { uint64_t bits; memcpy(&bits, &value, sizeof(bits)); return bits; }
+    inline uint64_t Bits(float value)   { uint32_t bits; memcpy(&bits, &value, sizeof(bits)); return bits; }
+    inline double ToDouble(uint64_t bits) { double value; memcpy(&value, &bits, sizeof(value)); return value; }
+    inline float ToFloat(uint64_t bits)   { uint32_t low = (uint32_t)bits; float value; memcpy(&value, &low, sizeof(value)); return value; }
+
+    // a chunk's columns in turn. every chunk starts its deltas afresh, so any
+    // chunk can be decoded on its own
+    //   steps          varint of the first, then varints of the differences
+    //   robots, actions, states, next states   varints
+    //   terminal       one byte each
+    //   rewards        PutXor against the reward before
+    //   observations   feature by feature, PutXor against the row before
+    //   next observations  feature by feature, PutXor against the row's observation
+    inline void Encode(const TransitionChunk & chunk, std::vector<uint8_t> & out)
+    {
+        size_t rows = chunk.size(), features = chunk.numFeatures;
+        out.clear();
+        out.reserve(rows * (16 + 4 * features));
+
+        for (size_t i = 0; i < rows; i++) { PutVarint(out, i ? chunk.steps[i] - chunk.steps[i - 1] : chunk.steps[i]); }
+        for (size_t i = 0; i < rows; i++) { PutVarint(out, chunk.robots[i]); }
+        for (size_t i = 0; i < rows; i++) { PutVarint(out, chunk.actions[i]); }
+        for (size_t i = 0; i < rows; i++) { PutVarint(out, chunk.states[i]); }
+        for (size_t i = 0; i < rows; i++) { PutVarint(out, chunk.nextStates[i]); }
+        out.insert(out.end(), chunk.terminal.begin(), chunk.terminal.end());
+        for (size_t i = 0; i < rows; i++) { PutXor(out, Bits(chunk.rewards[i]) ^ (i ? Bits(chunk.rewards[i - 1]) : 0)); }
+
+        for (size_t f = 0; f < features; f++)
+        {
+            for (size_t i = 0; i < rows; i++)
+            {
+                PutXor(out, Bits(chunk.observations[i * features + f]) ^ (i ? Bits(chunk.observations[(i - 1) * features + f]) : 0));
+            }
+        }
+        for (size_t f = 0; f < features; f++)
+        {
+            for (size_t i = 0; i < rows; i++)
+            {
+                PutXor(out, Bits(chunk.nextObservations[i * features + f]) ^ Bits(chunk.observations[i * features + f]));
+            }
+        }
+    }
+
+    // decodes rows transitions written by Encode, returns false if the bytes run out
+    inline bool Decode(const uint8_t * p, const uint8_t * end, size_t rows, size_t features, TransitionChunk & chunk)
+    {
+        chunk.numFeatures = features;
+        chunk.steps.resize(rows);
+        chunk.robots.resize(rows);
+        chunk.actions.resize(rows);
+        chunk.states.resize(rows);
+        chunk.nextStates.resize(rows);
+        chunk.terminal.resize(rows);
+        chunk.rewards.resize(rows);
+        chunk.observations.resize(rows * features);
+        chunk.nextObservations.resize(rows * features);
+
+        bool good = true;
+        uint64_t value = 0;
+        for (size_t i = 0; i < rows; i++) { good = good && GetVarint(p, end, value); chunk.steps[i] = value + (i ? chunk.steps[i - 1] : 0); }
+        for (size_t i = 0; i < rows; i++) { good = good && GetVarint(p, end, value); chunk.robots[i] = (uint32_t)value; }
+        for (size_t i = 0; i < rows; i++) { good = good && GetVarint(p, end, value); chunk.actions[i] = (uint32_t)value; }
+        for (size_t i = 0; i < rows; i++) { good = good && GetVarint(p, end, chunk.states[i]); }
+        for (size_t i = 0; i < rows; i++) { good = good && GetVarint(p, end, chunk.nextStates[i]); }
+
+        if (!good || (size_t)(end - p) < rows) { return false; }
+        memcpy(chunk.terminal.data(), p, rows);
+        p += rows;
+
+        for (size_t i = 0; i < rows; i++)
+        {
+            good = good && GetXor(p, end, value);
+            chunk.rewards[i] = ToFloat(value ^ (i ? Bits(chunk.rewards[i - 1]) : 0));
+        }
+        for (size_t f = 0; f < features; f++)
+        {
+            for (size_t i = 0; i < rows; i++)
+            {
+                good = good && GetXor(p, end, value);
+                chunk.observations[i * features + f] = ToDouble(value ^ (i ? Bits(chunk.observations[(i - 1) * features + f]) : 0));
+            }
+        }
+        for (size_t f = 0; f < features; f++)
+        {
+            for (size_t i = 0; i < rows; i++)
+            {
+                good = good && GetXor(p, end, value);
+                chunk.nextObservations[i * features + f] = ToDouble(value ^ Bits(chunk.observations[i * features + f]));
+            }
+        }
+        return good && p == end;
+    }
+}
+
+// Header of each chunk of a transition dataset, followed by its encoded bytes
+struct TransitionChunkHeader
+{
+    uint64_t rows;
+    uint64_t dataSize;
+    uint64_t checksum;      // QTableFileHeader::Checksum of the encoded bytes
+};
+
+// Records transitions for offline training and writes them on a background
+// thread
+// Transitions are recorded into one of two chunks. A full chunk is handed to
+// the writer thread, which encodes and writes it, while recording carries on
+// in the other; if the writer is still busy with the chunk before, recording
+// waits for it, so memory stays at two chunks however slow the disk is
+//
+//   "CWTRDATA" uint32 version, uint32 numFeatures, then each feature name
+//   NUL terminated, then chunks of a TransitionChunkHeader and its bytes
+class TransitionDatasetWriter
+{
+    struct Output
+    {
+        std::ofstream   file;
+        uint64_t        bytes = 0;      // written to file, only read once the writer is idle
+    };
+
+    std::shared_ptr<Output>             m_output;
+    std::shared_ptr<TransitionChunk>    m_chunks[2];
+    size_t                              m_front = 0;        // the chunk being recorded into
+    size_t                              m_chunkRows = 4096;
+    size_t                              m_numFeatures = 0;
+    size_t                              m_rows = 0;
+    size_t                              m_waits = 0;
+    BackgroundWorker                    m_writer;
+
+    static void WriteChunk(Output & out, const TransitionChunk & chunk)
+    {
+        std::vector<uint8_t> bytes;
+        TransitionCodec::Encode(chunk, bytes);
+
+        TransitionChunkHeader header = { chunk.size(), bytes.size(), QTableFileHeader::Checksum(bytes.data(), bytes.size()) };
+        out.file.write((const char *)&header, sizeof(header));
+        out.file.write((const char *)bytes.data(), bytes.size());
+        out.file.flush();
+        out.bytes += sizeof(header) + bytes.size();
+    }
+
+    // hands the recorded chunk to the writer and swaps to the other one
+    void submitChunk()
+    {
+        if (!m_output || m_chunks[m_front]->size() == 0) { return; }
+
+        // the other chunk can only be refilled once it has been written
+        if (m_writer.pending()) { m_waits++; m_writer.wait(); }
+
+        auto output = m_output;
+        auto chunk = m_chunks[m_front];
+        m_writer.submit([output, chunk] { WriteChunk(*output, *chunk); });
+
+        m_front = 1 - m_front;
+        m_chunks[m_front]->clear();
+    }
+
+public:
+
+    TransitionDatasetWriter() {}
+
+    ~TransitionDatasetWriter()
+    {
+        close();
+    }
+
+    TransitionDatasetWriter(const TransitionDatasetWriter &) = delete;
+    TransitionDatasetWriter & operator = (const TransitionDatasetWriter &) = delete;
+
+    // features names the slots of the observations, resumeBytes continues a
+    // file written earlier, cut back in place to its first resumeBytes bytes
+    bool open(const std::string & filename, const std::vector<std::string> & features, size_t chunkRows = 4096, uint64_t resumeBytes = 0)
+    {
+        close();
+
+        if (resumeBytes && !AtomicFile::TruncateTo(filename, resumeBytes, "transition dataset"))
+        {
+            return false;
+        }
+
+        auto output = std::make_shared<Output>();
+        output->file.open(filename, std::ios::binary | std::ios::out | (resumeBytes ? std::ios::app : std::ios::trunc));
+        if (!output->file.good())
+        {
+            std::cerr << "Could not open transition dataset: " << filename << "\n";
+            return false;
+        }
+
+        if (resumeBytes)
+        {
+            output->bytes = resumeBytes;
+        }
+        else
+        {
+            uint32_t version = 1, numFeatures = (uint32_t)features.size();
+            output->file.write("CWTRDATA", 8);
+            output->file.write((const char *)&version, sizeof(version));
+            output->file.write((const char *)&numFeatures, sizeof(numFeatures));
+            for (auto & name : features) { output->file.write(name.c_str(), name.size() + 1); }
+            output->file.flush();
+            output->bytes = (uint64_t)output->file.tellp();
+        }
+
+        m_output      = output;
+        m_chunkRows   = chunkRows ? chunkRows : 1;
+        m_numFeatures = features.size();
+        m_front       = 0;
+        for (auto & chunk : m_chunks)
+        {
+            chunk = std::make_shared<TransitionChunk>();
+            chunk->numFeatures = m_numFeatures;
+        }
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return m_output != nullptr;
+    }
+
+    // records one transition, obs and nextObs holding numFeatures readings each
+    inline void record(size_t step, size_t robot, size_t state, size_t action, double reward, size_t nextState, bool terminal,
+                       const double * obs, const double * nextObs)
+    {
+        TransitionChunk & chunk = *m_chunks[m_front];
+        chunk.steps.push_back(step);
+        chunk.robots.push_back((uint32_t)robot);
+        chunk.states.push_back(state);
+        chunk.actions.push_back((uint32_t)action);
+        chunk.rewards.push_back((float)reward);
+        chunk.nextStates.push_back(nextState);
+        chunk.terminal.push_back(terminal ? 1 : 0);
+        chunk.observations.insert(chunk.observations.end(), obs, obs + m_numFeatures);
+        chunk.nextObservations.insert(chunk.nextObservations.end(), nextObs, nextObs + m_numFeatures);
+        m_rows++;
+
+        if (chunk.size() == m_chunkRows) { submitChunk(); }
+    }
+
+    // writes every recorded transition, waiting until they are on disk
+    void sync()
+    {
+        submitChunk();
+        m_writer.wait();
+    }
+
+    // the length of the file once every transition recorded so far is
+    // written, a file reopened with this many resume bytes carries on from here
+    uint64_t bytesWritten()
+    {
+        sync();
+        return m_output ? m_output->bytes : 0;
+    }
+
+    void close()
+    {
+        if (!m_output) { return; }
+        sync();
+        m_output.reset();
+    }
+
+    // transitions recorded since open
+    size_t rows() const
+    {
+        return m_rows;
+    }
+
+    // times recording waited for the writer, a sign the disk is falling behind
+    size_t waits() const
+    {
+        return m_waits;
+    }
+};
+
+// Reads a transition dataset through a read-only mapping of the file
+// The chunks are found when the file is opened and each is decoded on
+// request, so a dataset larger than memory can be iterated a chunk at a
+// time. A chunk cut short by a crash ends the dataset, and readChunk
+// rejects a chunk whose checksum fails
+//
+//   TransitionChunk chunk;
+//   for (size_t c = 0; c < reader.numChunks(); c++) { reader.readChunk(c, chunk); ... }
+class TransitionDatasetReader
+{
+    MappedFile                  m_file;
+    std::vector<std::string>    m_features;
+    std::vector<size_t>         m_offsets;      // of each chunk's header
+    std::vector<size_t>         m_rows;         // of each chunk
+    size_t                      m_totalRows = 0;
+
+public:
+
+    TransitionDatasetReader() {}
+
+    // maps the file and finds its chunks, returns false if it is not a dataset
+    bool open(const std::string & filename)
+    {
+        m_features.clear();
+        m_offsets.clear();
+        m_rows.clear();
+        m_totalRows = 0;
+
+        if (!m_file.openRead(filename)) { return false; }
+        const uint8_t * data = m_file.data();
+        size_t size = m_file.size();
+
+        uint32_t version = 0, numFeatures = 0;
+        if (size < 16 || memcmp(data, "CWTRDATA", 8) != 0) { m_file.close(); return false; }
+        memcpy(&version, data + 8, sizeof(version));
+        memcpy(&numFeatures, data + 12, sizeof(numFeatures));
+        if (version != 1) { m_file.close(); return false; }
+
+        size_t pos = 16;
+        for (uint32_t f = 0; f < numFeatures; f++)
+        {
+            const uint8_t * nul = (const uint8_t *)memchr(data + pos, 0, size - pos);
+            if (!nul) { m_file.close(); return false; }
+            m_features.push_back(std::string((const char *)data + pos, nul - data - pos));
+            pos = nul - data + 1;
+        }
+
+        TransitionChunkHeader header;
+        while (size - pos >= sizeof(header))
+        {
+            memcpy(&header, data + pos, sizeof(header));
+            if (header.dataSize > size - pos - sizeof(header) || header.rows > header.dataSize) { break; }
+            m_offsets.push_back(pos);
+            m_rows.push_back((size_t)header.rows);
+            m_totalRows += (size_t)header.rows;
+            pos += sizeof(header) + (size_t)header.dataSize;
+        }
+        return true;
+    }
+
+    const std::vector<std::string> & featureNames() const
+    {
+        return m_features;
+    }
+
+    size_t numFeatures() const
+    {
+        return m_features.size();
+    }
+
+    size_t numChunks() const
+    {
+        return m_offsets.size();
+    }
+
+    size_t chunkRows(size_t c) const
+    {
+        return m_rows[c];
+    }
+
+    size_t numRows() const
+    {
+        return m_totalRows;
+    }
+
+    // decodes chunk c, returns false if its bytes are corrupt
+    bool readChunk(size_t c, TransitionChunk & chunk) const
+    {
+        TransitionChunkHeader header;
+        memcpy(&header, m_file.data() + m_offsets[c], sizeof(header));
+        const uint8_t * bytes = m_file.data() + m_offsets[c] + sizeof(header);
+        if (QTableFileHeader::Checksum(bytes, (size_t)header.dataSize) != header.checksum) { chunk.clear(); return false; }
+        return TransitionCodec::Decode(bytes, bytes + header.dataSize, (size_t)header.rows, m_features.size(), chunk);
+    }
+};
@@ -1,9 +1,10 @@
 #include "CWaggle.h"
 #include "RLExperiment.hpp"
 
-int main()
+// usage: cwaggle_rl [config file], the config defaults to rl_config.txt
+int main(int argc, char ** argv)
 {
-    RLExperiments::MainRLExperiment();
+    RLExperiments::MainRLExperiment(argc > 1 ? argv[1] : "rl_config.txt");
 
     return 0;
 }
\ No newline at end of file
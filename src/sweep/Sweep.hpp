@@ -0,0 +1,605 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#ifdef WIN32
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+// A parameter sweep over cwaggle_rl config keys and seeds
+// Spec files are 'key values' lines, # starts a comment:
+//
+//   binary       ./cwaggle_rl              program to run, given the run's config path
+//   baseConfig   rl_config.txt             config every run starts from
+//   outputDir    sweep                     one sub-directory per run is made in here
+//   concurrency  4                         runs in flight at once, 0 = one per core
+//   seeds        0 1 2 3                   every combination is run once per seed
+//   set          numRobots 20              override a key in every run
+//   sweep        alpha 0.1 0.2             one value per combination
+//   sweep        actions 2 0.3 -0.3 | 4 0.3 0.15 -0.15 -0.3
+//   scheduler    halving                   none, halving or median, see below
+//   metric       formations max            summary.txt value combinations are ranked by, max or min is best
+//   minSteps     20000                     steps of the first rung
+//   eta          3                         each rung runs eta times the steps of the one before
+//
+// values of a sweep line are split on '|' if it has one, otherwise on whitespace
+//
+// Without a scheduler every run goes straight to its maxTimeSteps. With one,
+// runs are taken to maxTimeSteps in rungs of minSteps, minSteps * eta, ...
+// and after each rung the combinations are ranked by the mean of the metric
+// over their seeds. halving keeps the best 1 / eta of them, median keeps
+// those at least as good as the median, and the rest are stopped. A run is
+// carried into the next rung from the checkpoint it wrote at the end of the
+// last one, so a run that reaches maxTimeSteps has exactly the results it
+// would have had run in one go. Stopped runs keep their checkpoint, and can
+// be carried on by hand. Every decision is written to decisions.txt
+struct SweepParameter
+{
+    std::string                 key;
+    std::vector<std::string>    values;
+};
+
+struct SweepRun
+{
+    size_t                                              index = 0;
+    size_t                                              combination = 0;    // runs that differ only by seed share this
+    size_t                                              seed = 0;
+    std::vector<std::pair<std::string, std::string>>    overrides;          // applied on top of the base config
+    std::string                                         dir;
+    int                                                 exitCode = 0;
+    std::map<std::string, double>                       results;            // read from the run's summary.txt
+    size_t                                              steps = 0;          // maxTimeSteps it has been run to, 0 if it has not run
+    bool                                                stopped = false;    // dropped by the scheduler before its maxTimeSteps
+};
+
+class Sweep
+{
+    std::string                 m_binary = "./cwaggle_rl";
+    std::string                 m_baseConfig = "rl_config.txt";
+    std::string                 m_outputDir = "sweep";
+    size_t                      m_concurrency = 0;
+    std::vector<size_t>         m_seeds = { 0 };
+    std::vector<SweepParameter> m_fixed;
+    std::vector<SweepParameter> m_parameters;
+    std::vector<std::string>    m_baseLines;
+    std::vector<SweepRun>       m_runs;
+    std::mutex                  m_printMutex;
+
+    std::string                 m_scheduler = "none";
+    std::string                 m_metric = "formations";
+    bool                        m_maximize = true;
+    size_t                      m_minSteps = 0;
+    double                      m_eta = 3;
+
+    static std::string Trim(const std::string & str)
+    {
+        size_t begin = str.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) { return ""; }
+        size_t end = str.find_last_not_of(" \t\r\n");
+        return str.substr(begin, end - begin + 1);
+    }
+
+    static std::vector<std::string> SplitValues(const std::string & str)
+    {
+        std::vector<std::string> values;
+        if (str.find('|') != std::string::npos)
+        {
+            std::stringstream ss(str);
+            std::string value;
+            while (std::getline(ss, value, '|')) { values.push_back(Trim(value)); }
+        }
+        else
+        {
+            std::stringstream ss(str);
+            std::string value;
+            while (ss >> value) { values.push_back(value); }
+        }
+        return values;
+    }
+
+    static std::string FirstToken(const std::string & line)
+    {
+        std::stringstream ss(line);
+        std::string token;
+        ss >> token;
+        return token;
+    }
+
+    static void MakeDirectory(const std::string & dir)
+    {
+        #ifdef WIN32
+            _mkdir(dir.c_str());
+        #else
+            mkdir(dir.c_str(), 0755);
+        #endif
+    }
+
+    // the base config with every overridden key removed, then the overrides
+    // keys are replaced rather than repeated because some keys, like actions,
+    // accumulate when they appear more than once
+    void writeConfig(const SweepRun & run, const std::string & filename) const
+    {
+        std::set<std::string> overridden;
+        for (auto & kv : run.overrides) { overridden.insert(kv.first); }
+
+        std::ofstream fout(filename);
+        for (auto & line : m_baseLines)
+        {
+            if (!overridden.count(FirstToken(line))) { fout << line << "\n"; }
+        }
+        for (auto & kv : run.overrides)
+        {
+            fout << kv.first << " " << kv.second << "\n";
+        }
+    }
+
+    // keys that name files, moved into the run's directory so concurrent runs
+    // never write to the same place. the value is the one the run ends up
+    // with, from the base config or the spec's set and sweep lines, and only
+    // its last field, the file name, is replaced, keeping any skip before it
+    void addFileOverrides(SweepRun & run) const
+    {
+        static const std::vector<std::pair<std::string, std::string>> files =
+        {
+            { "plotFilename",     "plot.txt" },
+            { "savePolicy",       "policy.qtable" },
+            { "saveCheckpoint",   "checkpoint.bin" },
+            { "resumeCheckpoint", "checkpoint.bin" },
+            { "saveTransitions",  "transitions.bin" },
+        };
+
+        for (auto & file : files)
+        {
+            std::string value = configValue(run, file.first);
+            if (value.empty()) { continue; }
+
+            size_t last = value.find_last_of(" \t");
+            std::string fields = last == std::string::npos ? "" : value.substr(0, last + 1);
+            SetOverride(run, file.first, fields + run.dir + "/" + file.second);
+        }
+    }
+
+    // replaces the override of key, or adds one
+    static void SetOverride(SweepRun & run, const std::string & key, const std::string & value)
+    {
+        for (auto & kv : run.overrides)
+        {
+            if (kv.first == key) { kv.second = value; return; }
+        }
+        run.overrides.push_back({ key, value });
+    }
+
+    // the value of key a run's config ends up with
+    std::string configValue(const SweepRun & run, const std::string & key) const
+    {
+        for (auto it = run.overrides.rbegin(); it != run.overrides.rend(); ++it)
+        {
+            if (it->first == key) { return it->second; }
+        }
+        std::string value;
+        for (auto & line : m_baseLines)
+        {
+            std::stringstream ss(line);
+            std::string token, rest;
+            ss >> token;
+            std::getline(ss, rest);
+            if (token == key) { value = Trim(rest); }
+        }
+        return value;
+    }
+
+    size_t maxSteps(const SweepRun & run) const
+    {
+        return (size_t)std::atoll(configValue(run, "maxTimeSteps").c_str());
+    }
+
+    // runs the run to steps maxTimeSteps, carrying on from its last rung's
+    // checkpoint if it has one, or to its own maxTimeSteps if steps is 0
+    void execute(SweepRun & run, size_t steps = 0)
+    {
+        MakeDirectory(run.dir);
+        std::string config = run.dir + "/config.txt";
+        SweepRun stage = run;
+        if (steps) { SetOverride(stage, "maxTimeSteps", std::to_string(steps)); }
+        writeConfig(stage, config);
+
+        // rungs after the first append to the log of the ones before
+        std::string command = m_binary + " \"" + config + "\" " + (run.steps ? ">>" : ">") + " \"" + run.dir + "/log.txt\" 2>&1";
+        run.exitCode = std::system(command.c_str());
+        run.steps = steps ? steps : maxSteps(run);
+
+        run.results.clear();
+        std::ifstream fin(run.dir + "/summary.txt");
+        std::string key;
+        double value;
+        while (fin >> key >> value) { run.results[key] = value; }
+
+        std::lock_guard<std::mutex> lock(m_printMutex);
+        std::cout << "Finished run " << run.index + 1 << " of " << m_runs.size() << ": " << run.dir;
+        if (steps) { std::cout << " to step " << steps; }
+        std::cout << (run.exitCode == 0 ? "" : " (failed)") << "\n";
+    }
+
+    // runs each of the given runs to the given steps, at most concurrency at a time
+    // runs are handed out in order as workers free up, since their lengths vary
+    void executeAll(const std::vector<std::pair<SweepRun *, size_t>> & jobs)
+    {
+        size_t numWorkers = m_concurrency ? m_concurrency : std::max(1u, std::thread::hardware_concurrency());
+        numWorkers = std::min(numWorkers, jobs.size());
+        std::cout << "Running " << jobs.size() << " runs, " << numWorkers << " at a time\n";
+
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < numWorkers; w++)
+        {
+            workers.emplace_back([&]
+            {
+                for (size_t i = next++; i < jobs.size(); i = next++) { execute(*jobs[i].first, jobs[i].second); }
+            });
+        }
+        for (auto & worker : workers) { worker.join(); }
+    }
+
+    // the mean of the metric over a combination's runs, failed runs and runs
+    // without the metric count as the worst possible value
+    double combinationScore(size_t combination) const
+    {
+        double worst = m_maximize ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+        double sum = 0;
+        size_t count = 0;
+        for (auto & run : m_runs)
+        {
+            if (run.combination != combination) { continue; }
+            auto it = run.results.find(m_metric);
+            if (run.exitCode != 0 || it == run.results.end()) { return worst; }
+            sum += it->second;
+            count++;
+        }
+        return count ? sum / count : worst;
+    }
+
+    // true if score a is strictly better than score b
+    bool better(double a, double b) const
+    {
+        return m_maximize ? a > b : a < b;
+    }
+
+    // ranks the combinations that just finished a rung and stops the ones
+    // the scheduler drops, writing every decision to the log
+    void schedule(const std::vector<size_t> & combinations, size_t rung, std::ofstream & log)
+    {
+        std::vector<std::pair<double, size_t>> ranked;
+        for (size_t c : combinations) { ranked.push_back({ combinationScore(c), c }); }
+        std::stable_sort(ranked.begin(), ranked.end(), [&](const std::pair<double, size_t> & a, const std::pair<double, size_t> & b)
+        {
+            return better(a.first, b.first);
+        });
+
+        // halving keeps a fixed fraction, median keeps every combination that is
+        // not worse than the median, and at least the best one is always kept
+        size_t keep = ranked.size();
+        std::string rule;
+        if (m_scheduler == "halving")
+        {
+            keep = std::max<size_t>(1, (size_t)std::ceil(ranked.size() / m_eta));
+            rule = "keeps the best " + std::to_string(keep);
+        }
+        else
+        {
+            size_t n = ranked.size();
+            double median = (ranked[(n - 1) / 2].first + ranked[n / 2].first) / 2;
+            keep = 1;
+            while (keep < n && !better(median, ranked[keep].first)) { keep++; }
+            std::stringstream ss;
+            ss << "keeps those not worse than the median " << median;
+            rule = ss.str();
+        }
+
+        log << "rung " << rung << ": " << ranked.size() << " combinations ranked by mean " << m_metric << ", "
+            << m_scheduler << " " << rule << "\n";
+
+        for (size_t r = 0; r < ranked.size(); r++)
+        {
+            bool kept = r < keep;
+            const SweepRun * first = nullptr;
+            for (auto & run : m_runs)
+            {
+                if (run.combination != ranked[r].second) { continue; }
+                if (!first) { first = &run; }
+                if (!kept) { run.stopped = true; }
+            }
+            log << "    " << (kept ? "continue " : "stop     ") << describe(*first) << " at " << first->steps << " steps, "
+                << m_metric << " " << ranked[r].first << " rank " << r + 1 << " of " << ranked.size() << "\n";
+        }
+        log.flush();
+    }
+
+    // takes every run to its maxTimeSteps in rungs, stopping the combinations
+    // the scheduler drops after each rung
+    void runScheduled()
+    {
+        std::ofstream log(m_outputDir + "/decisions.txt");
+        log << "scheduler " << m_scheduler << ", metric " << m_metric << (m_maximize ? " max" : " min")
+            << ", minSteps " << m_minSteps << ", eta " << m_eta << "\n";
+
+        // every run needs a checkpoint for its next rung to carry on from. a
+        // checkpoint left in the run's directory by an earlier sweep may come
+        // from other settings or be past this rung, so it is deleted and the
+        // first rung starts afresh, only the later ones resume
+        for (auto & run : m_runs)
+        {
+            std::string checkpoint = run.dir + "/checkpoint.bin";
+            if (configValue(run, "saveCheckpoint").empty()) { SetOverride(run, "saveCheckpoint", std::to_string(maxSteps(run)) + " " + checkpoint); }
+            SetOverride(run, "resumeCheckpoint", "0 " + checkpoint);
+            std::remove(checkpoint.c_str());
+            std::remove((checkpoint + ".tmp").c_str());
+        }
+
+        double rungSteps = (double)m_minSteps;
+        for (size_t rung = 0; ; rung++, rungSteps *= m_eta)
+        {
+            if (rung == 1)
+            {
+                for (auto & run : m_runs) { SetOverride(run, "resumeCheckpoint", "1 " + run.dir + "/checkpoint.bin"); }
+            }
+
+            std::vector<std::pair<SweepRun *, size_t>> jobs;
+            std::vector<size_t> combinations;
+            bool last = true;
+            for (auto & run : m_runs)
+            {
+                if (run.stopped || run.steps >= maxSteps(run)) { continue; }
+                size_t steps = std::min(maxSteps(run), (size_t)rungSteps);
+                jobs.push_back({ &run, steps });
+                last = last && steps == maxSteps(run);
+                if (combinations.empty() || combinations.back() != run.combination) { combinations.push_back(run.combination); }
+            }
+            if (jobs.empty()) { break; }
+
+            executeAll(jobs);
+            if (last) { break; }
+            schedule(combinations, rung, log);
+        }
+
+        // the compute spent, against taking every run to its maxTimeSteps
+        size_t used = 0, full = 0;
+        for (auto & run : m_runs) { used += run.steps; full += maxSteps(run); }
+        log << "ran " << used << " of the " << full << " steps of running every run to maxTimeSteps\n";
+        std::cout << "Scheduler ran " << used << " of " << full << " steps, decisions in " << m_outputDir << "/decisions.txt\n";
+    }
+
+    std::string describe(const SweepRun & run) const
+    {
+        std::stringstream ss;
+        for (size_t p = 0; p < m_parameters.size(); p++)
+        {
+            ss << (p ? " " : "") << m_parameters[p].key << "=" << run.overrides[p].second;
+        }
+        return m_parameters.empty() ? "base" : ss.str();
+    }
+
+public:
+
+    bool load(const std::string & filename)
+    {
+        std::ifstream fin(filename);
+        if (!fin.good())
+        {
+            std::cerr << "Sweep spec not found: " << filename << "\n";
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(fin, line))
+        {
+            line = Trim(line.substr(0, line.find('#')));
+            if (line.empty()) { continue; }
+
+            std::stringstream ss(line);
+            std::string token, rest;
+            ss >> token;
+            std::getline(ss, rest);
+
+            if (token == "binary")              { m_binary = Trim(rest); }
+            else if (token == "baseConfig")     { m_baseConfig = Trim(rest); }
+            else if (token == "outputDir")      { m_outputDir = Trim(rest); }
+            else if (token == "concurrency")    { m_concurrency = (size_t)std::atoi(rest.c_str()); }
+            else if (token == "scheduler")      { m_scheduler = Trim(rest); }
+            else if (token == "minSteps")       { m_minSteps = (size_t)std::atoll(rest.c_str()); }
+            else if (token == "eta")            { m_eta = std::atof(rest.c_str()); }
+            else if (token == "metric")
+            {
+                std::stringstream ms(rest);
+                std::string goal = "max";
+                ms >> m_metric >> goal;
+                m_maximize = goal != "min";
+            }
+            else if (token == "seeds")
+            {
+                m_seeds.clear();
+                for (auto & value : SplitValues(rest)) { m_seeds.push_back((size_t)std::atoll(value.c_str())); }
+            }
+            else if (token == "set" || token == "sweep")
+            {
+                std::stringstream rs(rest);
+                SweepParameter param;
+                rs >> param.key;
+                std::getline(rs, rest);
+                param.values = token == "set" ? std::vector<std::string>{ Trim(rest) } : SplitValues(rest);
+                if (param.key.empty() || param.values.empty())
+                {
+                    std::cerr << "Sweep line has no key or values: " << line << "\n";
+                    return false;
+                }
+                (token == "set" ? m_fixed : m_parameters).push_back(param);
+            }
+            else
+            {
+                std::cerr << "Unknown sweep spec key: " << token << "\n";
+                return false;
+            }
+        }
+
+        if (m_scheduler != "none" && m_scheduler != "halving" && m_scheduler != "median")
+        {
+            std::cerr << "Unknown scheduler, expected none, halving or median: " << m_scheduler << "\n";
+            return false;
+        }
+        if (m_scheduler != "none" && (m_minSteps == 0 || m_eta <= 1))
+        {
+            std::cerr << "A scheduler needs minSteps above 0 and eta above 1\n";
+            return false;
+        }
+
+        std::ifstream base(m_baseConfig);
+        if (!base.good())
+        {
+            std::cerr << "Base config not found: " << m_baseConfig << "\n";
+            return false;
+        }
+        while (std::getline(base, line)) { m_baseLines.push_back(line); }
+
+        expand();
+        return true;
+    }
+
+    // builds the cartesian product of the swept values, once per seed
+    void expand()
+    {
+        m_runs.clear();
+        size_t numCombinations = 1;
+        for (auto & param : m_parameters) { numCombinations *= param.values.size(); }
+
+        for (size_t c = 0; c < numCombinations; c++)
+        {
+            for (size_t seed : m_seeds)
+            {
+                SweepRun run;
+                run.index = m_runs.size();
+                run.combination = c;
+                run.seed = seed;
+
+                std::stringstream dir;
+                dir << m_outputDir << "/run_" << std::setw(4) << std::setfill('0') << run.index;
+                run.dir = dir.str();
+
+                // the swept values come first so describe() can find them by position
+                size_t rest = c;
+                for (auto & param : m_parameters)
+                {
+                    run.overrides.push_back({ param.key, param.values[rest % param.values.size()] });
+                    rest /= param.values.size();
+                }
+                for (auto & param : m_fixed) { run.overrides.push_back({ param.key, param.values[0] }); }
+                run.overrides.push_back({ "seed", std::to_string(seed) });
+                run.overrides.push_back({ "gui", "0" });
+                run.overrides.push_back({ "outputDir", run.dir });
+                addFileOverrides(run);
+
+                m_runs.push_back(run);
+            }
+        }
+    }
+
+    // runs every configuration, at most concurrency of them at a time, under
+    // the scheduler if there is one
+    void run()
+    {
+        MakeDirectory(m_outputDir);
+
+        if (m_scheduler != "none")
+        {
+            runScheduled();
+            return;
+        }
+
+        std::vector<std::pair<SweepRun *, size_t>> jobs;
+        for (auto & run : m_runs) { jobs.push_back({ &run, 0 }); }
+        executeAll(jobs);
+    }
+
+    // writes one line per run, and the mean and standard deviation of every
+    // result over the seeds of each combination
+    void writeSummary() const
+    {
+        std::set<std::string> keys;
+        for (auto & run : m_runs) { for (auto & kv : run.results) { keys.insert(kv.first); } }
+
+        std::string runsFile = m_outputDir + "/summary.txt";
+        std::ofstream fout(runsFile);
+        fout << "run seed exitCode";
+        for (auto & param : m_parameters) { fout << " " << param.key; }
+        for (auto & key : keys) { fout << " " << key; }
+        fout << "\n";
+
+        for (auto & run : m_runs)
+        {
+            fout << run.dir << " " << run.seed << " " << run.exitCode;
+            for (size_t p = 0; p < m_parameters.size(); p++)
+            {
+                // values with spaces are quoted so every row has the same number of columns
+                const std::string & value = run.overrides[p].second;
+                fout << " " << (value.find(' ') == std::string::npos ? value : "\"" + value + "\"");
+            }
+            for (auto & key : keys)
+            {
+                auto it = run.results.find(key);
+                if (it == run.results.end()) { fout << " -"; }
+                else { fout << " " << it->second; }
+            }
+            fout << "\n";
+        }
+
+        std::string groupFile = m_outputDir + "/summary_by_combination.txt";
+        std::ofstream gout(groupFile);
+        for (size_t c = 0; !m_runs.empty() && c <= m_runs.back().combination; c++)
+        {
+            const SweepRun * first = nullptr;
+            std::map<std::string, std::vector<double>> values;
+            for (auto & run : m_runs)
+            {
+                if (run.combination != c) { continue; }
+                if (!first) { first = &run; }
+                for (auto & kv : run.results) { values[kv.first].push_back(kv.second); }
+            }
+            if (!first) { continue; }
+
+            gout << describe(*first);
+            if (first->stopped) { gout << " (stopped by the scheduler at " << first->steps << " steps)"; }
+            gout << "\n";
+            for (auto & kv : values)
+            {
+                double mean = 0, var = 0;
+                for (double v : kv.second) { mean += v; }
+                mean /= kv.second.size();
+                for (double v : kv.second) { var += (v - mean) * (v - mean); }
+                var /= kv.second.size();
+                gout << "    " << kv.first << " " << mean << " +/- " << std::sqrt(var) << " (" << kv.second.size() << " runs)\n";
+            }
+        }
+
+        std::cout << "Wrote " << runsFile << " and " << groupFile << "\n";
+    }
+
+    size_t numRuns() const
+    {
+        return m_runs.size();
+    }
+};
@@ -0,0 +1,20 @@
+#include <iostream>
+
+#include "Sweep.hpp"
+
+// Runs cwaggle_rl over a grid of config values and seeds, see Sweep.hpp
+int main(int argc, char ** argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: cwaggle_sweep <sweep spec>\n";
+        return -1;
+    }
+
+    Sweep sweep;
+    if (!sweep.load(argv[1])) { return -1; }
+
+    sweep.run();
+    sweep.writeSummary();
+    return 0;
+}